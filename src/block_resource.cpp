@@ -0,0 +1,71 @@
+#include "block_resource.h"
+
+#include <cassert>
+#include <algorithm>
+
+void BlockResource::reset(std::byte* block, size_t size)
+{
+	assert(_numSpilled == 0);
+	this->block = block;
+	// the block start is aligned by its owner; the tail past the last whole ALIGNMENT is not used
+	blockSize = size / ALIGNMENT * ALIGNMENT;
+	numRanges = blockSize == 0 ? 0 : 1;
+	ranges[0] = { 0, blockSize };
+}
+
+void* BlockResource::do_allocate(size_t bytes, size_t alignment)
+{
+	bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	if (alignment <= ALIGNMENT) {
+		for (int i = 0; i < numRanges; i++) {
+			auto& range = ranges[i];
+			if (range.size < bytes)
+				continue;
+			auto ptr = block + range.offset;
+			range.offset += bytes;
+			range.size -= bytes;
+			if (range.size == 0) {
+				std::move(ranges.begin() + i + 1, ranges.begin() + numRanges, ranges.begin() + i);
+				numRanges--;
+			}
+			return ptr;
+		}
+	}
+	_numSpilled++;
+	return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void BlockResource::do_deallocate(void* ptr, size_t bytes, size_t alignment)
+{
+	bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	if (!owns(ptr)) {
+		assert(_numSpilled > 0);
+		_numSpilled--;
+		std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+		return;
+	}
+
+	// insert the range in offset order, merging it with the free ranges right before and after it
+	size_t offset = static_cast<std::byte*>(ptr) - block;
+	int pos = 0;
+	while (pos < numRanges && ranges[pos].offset < offset)
+		pos++;
+	bool mergesPrev = pos > 0 && ranges[pos - 1].offset + ranges[pos - 1].size == offset;
+	bool mergesNext = pos < numRanges && offset + bytes == ranges[pos].offset;
+	if (mergesPrev && mergesNext) {
+		ranges[pos - 1].size += bytes + ranges[pos].size;
+		std::move(ranges.begin() + pos + 1, ranges.begin() + numRanges, ranges.begin() + pos);
+		numRanges--;
+	}
+	else if (mergesPrev)
+		ranges[pos - 1].size += bytes;
+	else if (mergesNext) {
+		ranges[pos].offset = offset;
+		ranges[pos].size += bytes;
+	}
+	else if (numRanges < MAX_RANGES) {
+		std::move_backward(ranges.begin() + pos, ranges.begin() + numRanges, ranges.begin() + numRanges + 1);
+		ranges[pos] = { offset, bytes };
+		numRanges++;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+// hands out memory from one fixed block and takes it back, so that vectors growing and shrinking inside the block
+// reuse the space they leave behind
+// -- first fit over a short list of free ranges, kept sorted and coalesced; a few vectors live in a block at a time
+// -- a request that fits nowhere in the block spills to the heap, and is returned there
+class BlockResource : public std::pmr::memory_resource {
+public:
+	// every range starts and ends at this alignment
+	static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+
+	BlockResource(std::byte* block, size_t size) { reset(block, size); }
+	BlockResource(const BlockResource&) = delete;
+
+	// draw from another block; nothing may be allocated from the current one
+	void reset(std::byte* block, size_t size);
+	// forget the block, e.g., while it is lent to another node
+	void release() { reset(nullptr, 0); }
+	// allocations living on the heap right now
+	int numSpilled() const { return _numSpilled; }
+	std::byte* data() const { return block; }
+	size_t size() const { return blockSize; }
+	bool owns(const void* ptr) const {
+		auto bytePtr = static_cast<const std::byte*>(ptr);
+		return blockSize > 0 && bytePtr >= block && bytePtr < block + blockSize;
+	}
+private:
+	struct Range {
+		size_t offset;
+		size_t size;
+	};
+	// a free range beyond this many is dropped until reset(); live vectors leave at most one hole each
+	static constexpr int MAX_RANGES = 8;
+
+	std::byte* block;
+	size_t blockSize;
+	std::array<Range, MAX_RANGES> ranges;
+	int numRanges;
+	int _numSpilled{ 0 };
+
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
@@ -0,0 +1,158 @@
+#include "buffer_pool.h"
+
+#include <new>
+#include <cassert>
+#include <cstdio>
+
+PageFile::PageFile(const std::string& path) :
+	path(path), numPages(0), _numReads(0), _numWrites(0), _hasFailed(false)
+{
+	file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	_hasFailed = !file.is_open();
+}
+
+PageFile::~PageFile()
+{
+	file.close();
+	std::remove(path.c_str());
+}
+
+PageFile::PageId PageFile::allocate()
+{
+	if (!freePages.empty()) {
+		auto id = freePages.back();
+		freePages.pop_back();
+		return id;
+	}
+	return numPages++;
+}
+
+void PageFile::free(PageId id)
+{
+	assert(0 <= id && id < numPages);
+	freePages.push_back(id);
+}
+
+bool PageFile::read(PageId id, std::byte* page)
+{
+	assert(0 <= id && id < numPages);
+	_numReads++;
+	file.seekg((std::streamoff)id * BLOCK_SIZE);
+	file.read(reinterpret_cast<char*>(page), BLOCK_SIZE);
+	bool isRead = file && file.gcount() == BLOCK_SIZE;
+	_hasFailed = _hasFailed || !isRead;
+	return isRead;
+}
+
+bool PageFile::write(PageId id, const std::byte* page)
+{
+	assert(0 <= id && id < numPages);
+	if (_hasFailed)
+		return false;
+	_numWrites++;
+	file.seekp((std::streamoff)id * BLOCK_SIZE);
+	file.write(reinterpret_cast<const char*>(page), BLOCK_SIZE);
+	if (!file)
+		_hasFailed = true;
+	return !_hasFailed;
+}
+
+void PageFile::clear()
+{
+	numPages = 0;
+	freePages.clear();
+}
+
+BufferPool::BufferPool(size_t frameSize, int numFrames) :
+	_frameSize((frameSize + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT * FRAME_ALIGNMENT),
+	_numFrames(numFrames), _numResident(0), numAllocated(0), clockHand(0)
+{
+	assert(numFrames > 0);
+}
+
+BufferPool::~BufferPool()
+{
+	for (auto& frame : frames)
+		if (frame.data != nullptr)
+			::operator delete(frame.data, std::align_val_t{ FRAME_ALIGNMENT });
+}
+
+BufferPool::FrameId BufferPool::admit(void* owner)
+{
+	assert(owner != nullptr);
+	FrameId id;
+	if (!freeFrames.empty()) {
+		id = freeFrames.back();
+		freeFrames.pop_back();
+	}
+	else {
+		id = (FrameId)frames.size();
+		frames.emplace_back();
+	}
+	auto& frame = frames[id];
+	if (frame.data == nullptr) {
+		frame.data = static_cast<std::byte*>(::operator new(_frameSize, std::align_val_t{ FRAME_ALIGNMENT }));
+		numAllocated++;
+	}
+	frame.owner = owner;
+	frame.pinCount = 1;
+	frame.isDirty = false;
+	frame.isReferenced = true;
+	_numResident++;
+	return id;
+}
+
+void* BufferPool::findVictim()
+{
+	// two sweeps: the first may only clear reference bits
+	for (int i = 0; i < (int)frames.size() * 2; i++) {
+		auto& frame = frames[clockHand];
+		clockHand = (clockHand + 1) % (int)frames.size();
+		if (frame.owner == nullptr || frame.pinCount > 0)
+			continue;
+		if (frame.isReferenced) {
+			frame.isReferenced = false;
+			continue;
+		}
+		return frame.owner;
+	}
+	return nullptr;
+}
+
+void BufferPool::release(FrameId id)
+{
+	auto& frame = frames[id];
+	assert(frame.owner != nullptr);
+	frame.owner = nullptr;
+	frame.pinCount = 0;
+	frame.isDirty = false;
+	_numResident--;
+	if (numAllocated > _numFrames) {
+		::operator delete(frame.data, std::align_val_t{ FRAME_ALIGNMENT });
+		frame.data = nullptr;
+		numAllocated--;
+	}
+	freeFrames.push_back(id);
+}
+
+void BufferPool::clear()
+{
+	for (FrameId id = 0; id < (FrameId)frames.size(); id++)
+		if (frames[id].owner != nullptr)
+			release(id);
+}
+
+void BufferPool::pin(FrameId id)
+{
+	auto& frame = frames[id];
+	assert(frame.owner != nullptr);
+	frame.pinCount++;
+	frame.isReferenced = true;
+}
+
+void BufferPool::unpin(FrameId id)
+{
+	auto& frame = frames[id];
+	assert(frame.pinCount > 0);
+	frame.pinCount--;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "constants.h"
+#include "data.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstddef>
+
+// a file of BLOCK_SIZE pages; freed pages are reused before the file grows
+// -- scratch space, not a persistent format: the pages mean nothing without the nodes in memory that point at them,
+// and the file is removed with its owner
+// -- a failed open, read or write leaves the file failed for good (see hasFailed()); later writes are refused
+class PageFile {
+public:
+	using PageId = Int64;
+
+	// creates or truncates the file at path
+	PageFile(const std::string& path);
+	PageFile(const PageFile&) = delete;
+	// closes and removes the file
+	~PageFile();
+
+	PageId allocate();
+	void free(PageId id);
+	// returns false if the page could not be read, leaving page unspecified
+	bool read(PageId id, std::byte* page);
+	// returns false if the page could not be written, or the file has failed before
+	bool write(PageId id, const std::byte* page);
+	// frees every page at once
+	void clear();
+
+	long long numReads() const { return _numReads; }
+	long long numWrites() const { return _numWrites; }
+	bool hasFailed() const { return _hasFailed; }
+	// for the owner that finds a page read back other than written
+	void markFailed() { _hasFailed = true; }
+private:
+	std::string path;
+	std::fstream file;
+	PageId numPages;
+	std::vector<PageId> freePages;
+	long long _numReads;
+	long long _numWrites;
+	bool _hasFailed;
+};
+
+// keeps the frames of at most numFrames owners in memory, choosing victims by CLOCK
+// -- a pinned frame is never a victim, and the owner writes a dirty victim back before releasing it
+// -- when every frame is pinned, admit() goes over numFrames until the caller evicts again
+class BufferPool {
+public:
+	using FrameId = int;
+	static constexpr size_t FRAME_ALIGNMENT = 64;
+
+	BufferPool(size_t frameSize, int numFrames);
+	BufferPool(const BufferPool&) = delete;
+	~BufferPool();
+
+	// takes a frame for owner, pinned and clean
+	FrameId admit(void* owner);
+	// returns the owner of an unpinned frame chosen by CLOCK, or nullptr if every frame is pinned
+	void* findVictim();
+	void release(FrameId id);
+	// releases every frame at once
+	void clear();
+
+	void pin(FrameId id);
+	void unpin(FrameId id);
+	void markDirty(FrameId id) { frames[id].isDirty = true; }
+	void markClean(FrameId id) { frames[id].isDirty = false; }
+	bool isPinned(FrameId id) const { return frames[id].pinCount > 0; }
+	bool isDirty(FrameId id) const { return frames[id].isDirty; }
+	std::byte* data(FrameId id) const { return frames[id].data; }
+
+	size_t frameSize() const { return _frameSize; }
+	int numFrames() const { return _numFrames; }
+	int numResident() const { return _numResident; }
+	bool isFull() const { return _numResident >= _numFrames; }
+	bool isOverCapacity() const { return _numResident > _numFrames; }
+private:
+	struct Frame {
+		std::byte* data{ nullptr };
+		void* owner{ nullptr };
+		int pinCount{ 0 };
+		bool isDirty{ false };
+		bool isReferenced{ false };
+	};
+
+	size_t _frameSize;
+	int _numFrames;
+	int _numResident;
+	std::vector<Frame> frames;
+	std::vector<FrameId> freeFrames;
+	// frames holding memory; memory beyond numFrames is given back as soon as its frame is released
+	int numAllocated;
+	int clockHand;
+};
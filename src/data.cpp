@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <chrono>
+#include <cstring>
 
 Date::Date()
 {
@@ -35,8 +36,7 @@ PackedData::PackedData()
 PackedData::PackedData(const std::vector<DataType>& types, const std::vector<std::string>& data)
 {
 	int n = types.size();
-	_capacity = computeSize(types);
-	_base = malloc(_capacity);
+	allocate(computeSize(types));
 	_size = 0;
 	for(int i=0; i<n; i++){
 		auto& type = types[i];
@@ -45,7 +45,7 @@ PackedData::PackedData(const std::vector<DataType>& types, const std::vector<std
 			push(std::stoi(data[i]));
 			break;
 		case DataType::INT64:
-			push(std::stoll(data[i]));
+			push((Int64)std::stoll(data[i]));
 			break;
 		case DataType::STRING:
 			push(data[i]);
@@ -54,19 +54,18 @@ PackedData::PackedData(const std::vector<DataType>& types, const std::vector<std
 			push(std::stoi(data[i]));
 			break;
 		case DataType::DATETIME:
-			push(std::stoll(data[i]));
+			push((Int64)std::stoll(data[i]));
 			break;
 		case DataType::HASHED_INT:
-			push(std::stoll(data[i]));
+			push((Int64)std::stoll(data[i]));
 			break;
 		}
 	}
 }
 
-PackedData::PackedData(int capacity) :
-	_capacity(capacity)
+PackedData::PackedData(int capacity)
 {
-	_base = malloc(capacity);
+	allocate(capacity);
 	_size = 0;
 }
 
@@ -74,71 +73,43 @@ PackedData::PackedData(const PackedData& other)
 {
 	assert(other._capacity != 0);
 	assert(other._base != nullptr);
-	_capacity = other._capacity;
-	_base = malloc(_capacity);
+	allocate(other._size);
 	_size = other._size;
-	{
-		auto dst = static_cast<std::int32_t*>(_base);
-		auto src = static_cast<std::int32_t*>(other._base);
-		for (int i = 0; i < _size / 4; i++)
-			*(dst + i) = *(src + i);
-	}
-	if(_size % 4 != 0){
-		int r = _size % 4;
-		auto dst = static_cast<std::byte*>(_base);
-		auto src = static_cast<std::byte*>(other._base);
-		for (int i = _size - 1; i >= _size - r; i--)
-			*(dst + i) = *(src + i);
-	}
+	std::memcpy(_base, other._base, _size);
 }
 
 PackedData::PackedData(PackedData&& other) noexcept
 {
-	_capacity = other._capacity;
-	_size = other._size;
-	_base = other._base;
-	other._base = nullptr;
+	steal(other);
 }
 
 PackedData& PackedData::operator=(const PackedData& other)
 {
 	assert(other._capacity != 0);
 	assert(other._base != nullptr);
+	if (this == &other)
+		return *this;
 	if (_capacity < other._size) {
-		free(_base);
-		_capacity = other._size;
-		_base = malloc(_capacity);
+		release();
+		allocate(other._size);
 	}
 	_size = other._size;
-	{
-		auto dst = static_cast<std::int32_t*>(_base);
-		auto src = static_cast<std::int32_t*>(other._base);
-		for (int i = 0; i < _size / 4; i++)
-			*(dst + i) = *(src + i);
-	}
-	if (_size % 4 != 0) {
-		int r = _size % 4;
-		auto dst = static_cast<std::byte*>(_base);
-		auto src = static_cast<std::byte*>(other._base);
-		for (int i = _size - 1; i >= _size - r; i--)
-			*(dst + i) = *(src + i);
-	}
+	std::memcpy(_base, other._base, _size);
 	return *this;
 }
 
 PackedData& PackedData::operator=(PackedData&& other) noexcept
 {
-	free(_base);
-	_capacity = other._capacity;
-	_size = other._size;
-	_base = other._base;
-	other._base = nullptr;
+	if (this == &other)
+		return *this;
+	release();
+	steal(other);
 	return *this;
 }
 
 void PackedData::reset()
 {
-	free(_base);
+	release();
 	_base = nullptr;
 	_capacity = 0;
 	_size = 0;
@@ -146,15 +117,50 @@ void PackedData::reset()
 
 PackedData::~PackedData()
 {
-	free(_base);
+	release();
+}
+
+void PackedData::allocate(size_t capacity)
+{
+	if (capacity <= INLINE_CAPACITY) {
+		_base = _inline;
+		_capacity = INLINE_CAPACITY;
+	}
+	else {
+		_base = malloc(capacity);
+		_capacity = capacity;
+	}
+}
+
+void PackedData::release()
+{
+	if (!isInline())
+		free(_base);
+}
+
+void PackedData::steal(PackedData& other)
+{
+	_size = other._size;
+	if (other.isInline()) {
+		std::memcpy(_inline, other._inline, _size);
+		_base = _inline;
+		_capacity = INLINE_CAPACITY;
+	}
+	else {
+		_base = other._base;
+		_capacity = other._capacity;
+	}
+	other._base = nullptr;
+	other._capacity = 0;
+	other._size = 0;
 }
 
 void PackedData::push(std::int32_t val)
 {
 	while (_size + sizeof(val) > _capacity)
 		grow();
-	auto ptr = reinterpret_cast<std::int32_t*> ((size_t)_base + _size);
-	*ptr = val;
+	// the column may start at any offset after a STRING column
+	std::memcpy(static_cast<std::byte*>(_base) + _size, &val, sizeof(val));
 	_size += sizeof(val);
 }
 
@@ -162,27 +168,20 @@ void PackedData::push(std::int64_t val)
 {
 	while (_size + sizeof(val) > _capacity)
 		grow();
-	auto ptr = reinterpret_cast<std::int64_t*> ((size_t)_base + _size);
-	*ptr = val;
+	std::memcpy(static_cast<std::byte*>(_base) + _size, &val, sizeof(val));
 	_size += sizeof(val);
 }
 
 void PackedData::push(const std::string& val)
 {
-	while (_size + sizeof(val) > _capacity)
-		grow();
-	auto ptr = reinterpret_cast<std::string*> ((size_t)_base + _size);
-	*ptr = val;
-	_size += sizeof(val);
+	Int32 length = (Int32)val.size();
+	push(reinterpret_cast<const std::byte*>(&length), sizeof(length));
+	push(reinterpret_cast<const std::byte*>(val.data()), (int)val.size());
 }
 
 void PackedData::push(std::string&& val)
 {
-	while (_size + sizeof(val) > _capacity)
-		grow();
-	auto ptr = reinterpret_cast<std::string*> ((size_t)_base + _size);
-	*ptr = std::move(val);
-	_size += sizeof(val);
+	push(static_cast<const std::string&>(val));
 }
 
 void PackedData::push(const Date& val)
@@ -200,6 +199,23 @@ void PackedData::push(const HashedInt& val)
 	push(val.data());
 }
 
+void PackedData::push(const std::byte* bytes, int size)
+{
+	while (_size + size > _capacity)
+		grow();
+	std::memcpy(static_cast<std::byte*>(_base) + _size, bytes, size);
+	_size += size;
+}
+
+std::string_view PackedData::readString(const std::byte*& ptr)
+{
+	Int32 length;
+	std::memcpy(&length, ptr, sizeof(length));
+	std::string_view res(reinterpret_cast<const char*>(ptr + sizeof(length)), length);
+	ptr += sizeof(length) + length;
+	return res;
+}
+
 PackedData PackedData::combine(const PackedData& data, std::int64_t val)
 {
 	PackedData res(data.size() + sizeof(std::int64_t));
@@ -208,6 +224,15 @@ PackedData PackedData::combine(const PackedData& data, std::int64_t val)
 	return res;
 }
 
+PackedData PackedData::truncate(const PackedData& data, int size)
+{
+	assert(size <= data.size());
+	PackedData res(size);
+	std::memcpy(res._base, data._base, size);
+	res._size = size;
+	return res;
+}
+
 int PackedData::computeSize(const std::vector<DataType>& types)
 {
 	int size = 0;
@@ -220,7 +245,8 @@ int PackedData::computeSize(const std::vector<DataType>& types)
 			size += sizeof(Int64);
 			break;
 		case DataType::STRING:
-			size += sizeof(String);
+			// the length prefix and a short string
+			size += sizeof(Int32) + 16;
 			break;
 		case DataType::DATE:
 			size += sizeof(Date);
@@ -238,13 +264,12 @@ int PackedData::computeSize(const std::vector<DataType>& types)
 void PackedData::grow()
 {
 	if (_capacity == 0) {
-		_capacity = 4;
-		_base = malloc(_capacity);
+		allocate(INLINE_CAPACITY);
 		return;
 	}
-	_capacity *= 2;
-	void* dest = malloc(_capacity);
+	void* dest = malloc(_capacity * 2);
 	std::memcpy(dest, _base, _size);
-	delete _base;
+	release();
 	_base = dest;
-}
\ No newline at end of file
+	_capacity *= 2;
+}
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <array>
+#include <cstddef>
+#include <cstring>
 
 enum class DataType {
 	INT32,
@@ -79,16 +82,41 @@ public:
 	void push(const Date& val);
 	void push(const DateTime& val);
 	void push(const HashedInt& val);
+	// appends raw bytes
+	void push(const std::byte* bytes, int size);
+
+	// a STRING column is stored as its length (Int32) followed by its bytes
+	// returns a view of the string at ptr and advances ptr past it
+	static std::string_view readString(const std::byte*& ptr);
+	// returns the fixed-size column at ptr; a STRING column before it leaves ptr at any alignment
+	template<typename T>
+	static T read(const std::byte* ptr) {
+		T val;
+		std::memcpy(&val, ptr, sizeof(val));
+		return val;
+	}
 
 	static PackedData combine(const PackedData& data, std::int64_t val);
+	// the first size bytes of data
+	static PackedData truncate(const PackedData& data, int size);
 
 	int size() const { return (int)_size; }
 	void* get() const { return _base; }
 	static int computeSize(const std::vector<DataType>& types);
 private:
+	// payloads up to INLINE_CAPACITY bytes live in _inline, larger ones spill to the heap
+	static constexpr size_t INLINE_CAPACITY = 24;
+
 	void* _base;
 	size_t _size;
 	size_t _capacity;
+	alignas(std::int64_t) std::byte _inline[INLINE_CAPACITY];
 
+	bool isInline() const { return _base == _inline; }
+	// point _base to a buffer of at least capacity bytes; the current buffer must be released
+	void allocate(size_t capacity);
+	void release();
+	// take over the payload of other and leave it null
+	void steal(PackedData& other);
 	void grow();
 };
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "file_sync.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool syncFile(std::FILE* file)
+{
+	if (std::fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool syncDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	return true;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	bool isSynced = fsync(fd) == 0;
+	close(fd);
+	return isSynced;
+#endif
+}
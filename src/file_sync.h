@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// flush and fsync file; returns false on an I/O error
+bool syncFile(std::FILE* file);
+
+// fsync the directory at path, so that entries created or renamed in it are on disk
+// -- Windows has no such call, and commits a rename with the file system metadata
+bool syncDirectory(const std::string& path);
@@ -1,68 +1,418 @@
 #include "index.h"
+#include "file_sync.h"
 
+#include <new>
 #include <cmath>
 #include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <functional>
+#include <cstring>
+#include <limits>
+#include <unordered_set>
+#include <bit>
+#include <fstream>
+#include <random>
+#include <cstdio>
+#include <filesystem>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+namespace {
+	std::vector<DataType> makeTypes(const std::vector<DataType>& types, bool allowsDuplicate) {
+		auto res = types;
+		if (allowsDuplicate)
+			res.push_back(DataType::INT64);
+		return res;
+	}
 
-std::vector<DataType> makeTypes(const std::vector<DataType>& types, bool allowsDuplicate) {
-	auto res = types;
-	if (allowsDuplicate)
-		res.push_back(DataType::INT64);
-	return res;
+	// a checkpoint is [magic, version], then [key size, key bytes, rid] per entry in key order, then the footer:
+	// [number of entries, last lsn of the attached log, allowsDuplicate, normalizesKey, number of columns, (type, name size, name bytes) per column],
+	// and last [offset of the footer, magic]
+	constexpr char CHECKPOINT_MAGIC[8] = { 'P', 'D', 'B', 'I', 'N', 'D', 'E', 'X' };
+	constexpr Int32 CHECKPOINT_VERSION = 1;
+
+	// a binary search over sorted prefixes stops at this many, which countLessGreater() takes in one pass
+	constexpr int PREFIX_WINDOW = 16;
+
+	// counts vals[i] < x and vals[i] > x with compare-and-movemask, 4 (AVX2) or 2 (SSE4.2) at a time where the
+	// build enables them (-mavx2, -msse4.2), and one at a time otherwise
+	void countLessGreater(const Int64* vals, int n, Int64 x, int& numLess, int& numGreater) {
+		numLess = 0;
+		numGreater = 0;
+		int i = 0;
+#if defined(__AVX2__)
+		__m256i pivot = _mm256_set1_epi64x(x);
+		for (; i + 4 <= n; i += 4) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vals + i));
+			numLess += std::popcount((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, v))));
+			numGreater += std::popcount((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, pivot))));
+		}
+#elif defined(__SSE4_2__)
+		__m128i pivot = _mm_set1_epi64x(x);
+		for (; i + 2 <= n; i += 2) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + i));
+			numLess += std::popcount((unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(pivot, v))));
+			numGreater += std::popcount((unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, pivot))));
+		}
+#endif
+		for (; i < n; i++) {
+			numLess += vals[i] < x;
+			numGreater += vals[i] > x;
+		}
+	}
+
+	// the first of sorted vals[lo, hi) that is >= x, or > x with pastEqual
+	int searchSorted(const Int64* vals, int lo, int hi, Int64 x, bool pastEqual) {
+		while (hi - lo > PREFIX_WINDOW) {
+			int mid = lo + (hi - lo) / 2;
+			if (vals[mid] < x || (pastEqual && vals[mid] == x))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		int numLess, numGreater;
+		countLessGreater(vals + lo, hi - lo, x, numLess, numGreater);
+		return pastEqual ? hi - numGreater : lo + numLess;
+	}
+
+	// FNV-1a, with the 64-bit finalizer of MurmurHash3 to spread the low bits
+	std::uint64_t hashBytes(const std::byte* bytes, int size) {
+		std::uint64_t h = 0xcbf29ce484222325ull;
+		for (int i = 0; i < size; i++) {
+			h ^= static_cast<std::uint64_t>(bytes[i]);
+			h *= 0x100000001b3ull;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// the bits of a filter word a hash sets: four 6-bit positions from the high half, as the low half picks the word
+	std::uint64_t filterMask(std::uint64_t hash) {
+		return (1ull << ((hash >> 32) & 63)) | (1ull << ((hash >> 38) & 63))
+			| (1ull << ((hash >> 44) & 63)) | (1ull << ((hash >> 50) & 63));
+	}
+
+	// hint that the cache line at ptr is read soon; never faults
+	void prefetch(const void* ptr) {
+#if defined(_MSC_VER)
+		_mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+#else
+		__builtin_prefetch(ptr);
+#endif
+	}
 }
 
-Index::Index(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate) :
-	types(makeTypes(types, allowsDuplicate)), names(names), allowsDuplicate(allowsDuplicate),
-	maxBranchingFactor(computeBranchingFactor(types, BLOCK_SIZE)),
-	maxLazySize((int)sqrt(maxBranchingFactor)), // (13.3) - Then, non-static data members are initialized in the order they were declared in the class definition (again regardless of the order of the mem-initializers).
-	root(new Node(true, maxBranchingFactor, maxLazySize))
+Index::Index(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate,
+	bool normalizesKey, const std::string& storagePath, int numFrames) :
+	types(makeTypes(types, allowsDuplicate)), names(names), allowsDuplicate(allowsDuplicate), normalizesKey(normalizesKey),
+	maxBranchingFactor(computeBranchingFactor(BLOCK_SIZE)),
+	reservedLazySize((int)sqrt(maxBranchingFactor)), // (13.3) - Then, non-static data members are initialized in the order they were declared in the class definition (again regardless of the order of the mem-initializers).
+	maxLazySize(reservedLazySize),
+	nodePool(computeBlockOffset() + (storagePath.empty() ? Node::computeBlockSize(maxBranchingFactor, reservedLazySize) : 0),
+		NODES_PER_SLAB),
+	pageFile(storagePath.empty() ? nullptr : std::make_unique<PageFile>(storagePath)),
+	bufferPool(storagePath.empty() ? nullptr :
+		std::make_unique<BufferPool>(Node::computeBlockSize(maxBranchingFactor, reservedLazySize), numFrames)),
+	operationDepth(0), log(nullptr), commitsLog(true), appliedLsn(0),
+	defersMaintenance(false), maxPushesPerOperation(0), pushBudget(-1),
+	readCompactionThreshold(0), hasHotNodes(false),
+	adaptsLazySize(false), numReadsSeen(0), numWritesSeen(0), usesFilters(false), root(nullptr)
 {
+	Operation operation(this);
+	root = newNode(true);
 }
 
 Index::Index(Index&& other) noexcept :
-	types(other.types), names(other.names), allowsDuplicate(other.allowsDuplicate),
-	maxBranchingFactor(other.maxBranchingFactor), maxLazySize(other.maxLazySize),
-	root(other.root)
+	types(other.types), names(other.names), allowsDuplicate(other.allowsDuplicate), normalizesKey(other.normalizesKey),
+	maxBranchingFactor(other.maxBranchingFactor), reservedLazySize(other.reservedLazySize), maxLazySize(other.maxLazySize),
+	nodePool(std::move(other.nodePool)), pageFile(std::move(other.pageFile)), bufferPool(std::move(other.bufferPool)),
+	pinnedNodes(std::move(other.pinnedNodes)), operationDepth(other.operationDepth), log(other.log), commitsLog(other.commitsLog),
+	appliedLsn(other.appliedLsn), defersMaintenance(other.defersMaintenance), sweepRandom(other.sweepRandom),
+	maxPushesPerOperation(other.maxPushesPerOperation), pushBudget(other.pushBudget),
+	readCompactionThreshold(other.readCompactionThreshold), hasHotNodes(other.hasHotNodes),
+	adaptsLazySize(other.adaptsLazySize), numReadsSeen(other.numReadsSeen), numWritesSeen(other.numWritesSeen),
+	usesFilters(other.usesFilters), root(other.root)
 {
 	other.root = nullptr;
 }
 
 Index::~Index()
 {
-	clean(root);
+	clean();
+}
+
+std::optional<Index> Index::bulkLoad(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate,
+	const std::vector<PackedData>& keys, const std::vector<Int64>& rids, double fillFactor, bool normalizesKey)
+{
+	assert(keys.size() == rids.size());
+	Index index(types, names, allowsDuplicate, normalizesKey);
+
+	std::vector<KeyValue> kvs;
+	kvs.reserve(keys.size());
+	for (int i = 0; i < (int)keys.size(); i++) {
+		assert(rids[i] != INVALID_RID);
+		kvs.emplace_back(index.makeInternalKey(keys[i], rids[i]), rids[i]);
+	}
+	std::sort(kvs.begin(), kvs.end(),
+		[&index](const KeyValue& kv1, const KeyValue& kv2) {return index.compareKeyValue(kv1, kv2); });
+	// a key of a unique index, or a pair, given twice
+	for (int i = 1; i < (int)kvs.size(); i++)
+		if (index.comparePackData(kvs[i - 1].key, kvs[i].key) == 0)
+			return std::nullopt;
+
+	index.build(std::move(kvs), fillFactor);
+	return index;
+}
+
+std::optional<Index> Index::open(const std::string& path, double fillFactor,
+	const std::string& storagePath, int numFrames)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return std::nullopt;
+	auto read = [&in](void* ptr, size_t size) {
+		in.read(static_cast<char*>(ptr), size);
+		return in.good();
+	};
+
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	Int32 version;
+	if (!read(magic, sizeof(magic)) || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+		!read(&version, sizeof(version)) || version != CHECKPOINT_VERSION)
+		return std::nullopt;
+	Int64 entriesStart = in.tellg();
+	in.seekg(0, std::ios::end);
+	Int64 fileSize = in.tellg();
+
+	// the schema is in the footer, found through the trailer
+	Int64 footerOffset;
+	Int64 trailerSize = sizeof(footerOffset) + sizeof(magic);
+	if (fileSize < entriesStart + trailerSize)
+		return std::nullopt;
+	in.seekg(fileSize - trailerSize);
+	if (!read(&footerOffset, sizeof(footerOffset)) || !read(magic, sizeof(magic)) ||
+		std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+		return std::nullopt;
+	if (footerOffset < entriesStart || footerOffset > fileSize - trailerSize)
+		return std::nullopt;
+	in.seekg(footerOffset);
+	Int64 numEntries;
+	WriteAheadLog::Lsn lsn;
+	std::uint8_t allowsDuplicate, normalizesKey;
+	Int32 numColumns;
+	if (!read(&numEntries, sizeof(numEntries)) || !read(&lsn, sizeof(lsn)) || !read(&allowsDuplicate, sizeof(allowsDuplicate)) ||
+		!read(&normalizesKey, sizeof(normalizesKey)) || !read(&numColumns, sizeof(numColumns)) || numColumns <= 0)
+		return std::nullopt;
+	// an entry takes at least its key size and rid, and a column at least its type and name size
+	constexpr Int64 MIN_ENTRY_SIZE = sizeof(Int32) + sizeof(Int64);
+	if (numEntries < 0 || numEntries > (footerOffset - entriesStart) / MIN_ENTRY_SIZE ||
+		numColumns > (fileSize - footerOffset) / (Int64)(sizeof(Int32) * 2))
+		return std::nullopt;
+	std::vector<DataType> types(numColumns);
+	std::vector<std::string> names(numColumns);
+	for (int i = 0; i < numColumns; i++) {
+		Int32 type, size;
+		if (!read(&type, sizeof(type)) || !read(&size, sizeof(size)) || size < 0 || size > fileSize - footerOffset)
+			return std::nullopt;
+		if (type < static_cast<Int32>(DataType::INT32) || type > static_cast<Int32>(DataType::HASHED_INT))
+			return std::nullopt;
+		types[i] = static_cast<DataType>(type);
+		names[i].resize(size);
+		if (!read(names[i].data(), size))
+			return std::nullopt;
+	}
+
+	// entries are internal keys in order, so they go straight to build()
+	Index index(types, names, allowsDuplicate != 0, normalizesKey != 0, storagePath, numFrames);
+	std::vector<KeyValue> kvs;
+	kvs.reserve(numEntries);
+	in.seekg(entriesStart);
+	std::vector<std::byte> buffer;
+	for (Int64 i = 0; i < numEntries; i++) {
+		Int32 size;
+		Int64 rid;
+		if (!read(&size, sizeof(size)) || size < 0 || size > footerOffset - entriesStart)
+			return std::nullopt;
+		buffer.resize(size);
+		if (!read(buffer.data(), size) || !read(&rid, sizeof(rid)))
+			return std::nullopt;
+		PackedData key(size);
+		key.push(buffer.data(), size);
+		kvs.emplace_back(key, rid);
+	}
+	if (in.tellg() != footerOffset)
+		return std::nullopt;
+
+	index.build(std::move(kvs), fillFactor);
+	index.appliedLsn = lsn;
+	return index;
+}
+
+bool Index::checkpoint(const std::string& path)
+{
+	// pairs may be lost with a node that could not be read
+	if (hasStorageFailed())
+		return false;
+	Operation operation(this);
+	// written aside and renamed, so that path always holds a complete checkpoint
+	auto tempPath = path + ".tmp";
+	auto out = std::fopen(tempPath.c_str(), "wb");
+	if (out == nullptr)
+		return false;
+	bool isGood = true;
+	Int64 offset = 0;
+	auto write = [&](const void* ptr, size_t size) {
+		isGood = isGood && std::fwrite(ptr, 1, size, out) == size;
+		offset += size;
+	};
+	write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	write(&CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION));
+
+	// the cursor folds the pending kvs of the ancestors into each leaf
+	Int64 numEntries = 0;
+	auto lo = findSmallestKey(root);
+	if (lo.get() != nullptr) {
+		auto it = cursor();
+		for (it.load(std::move(lo)); it.valid(); it.next()) {
+			auto& key = it.internalKey();
+			Int32 size = key.size();
+			Int64 rid = it.rid();
+			write(&size, sizeof(size));
+			write(key.get(), size);
+			write(&rid, sizeof(rid));
+			numEntries++;
+		}
+	}
+
+	Int64 footerOffset = offset;
+	std::uint8_t flags[2] = { allowsDuplicate, normalizesKey };
+	// the rid column added for duplicates is not part of the schema
+	Int32 numColumns = (Int32)types.size() - (allowsDuplicate ? 1 : 0);
+	WriteAheadLog::Lsn lsn = log != nullptr ? log->lastLsn() : appliedLsn;
+	write(&numEntries, sizeof(numEntries));
+	write(&lsn, sizeof(lsn));
+	write(flags, sizeof(flags));
+	write(&numColumns, sizeof(numColumns));
+	for (int i = 0; i < numColumns; i++) {
+		Int32 type = static_cast<Int32>(types[i]);
+		Int32 size = (Int32)names[i].size();
+		write(&type, sizeof(type));
+		write(&size, sizeof(size));
+		write(names[i].data(), size);
+	}
+	write(&footerOffset, sizeof(footerOffset));
+	write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	// on disk before the rename, so that path never names a file with unwritten data
+	isGood = isGood && syncFile(out);
+	isGood = std::fclose(out) == 0 && isGood;
+	if (!isGood)
+		return false;
+
+	// rename replaces path atomically; the directory is synced for the rename itself to survive a crash
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	return !error && syncDirectory(std::filesystem::absolute(path).parent_path().string());
 }
 
 bool Index::insert(const PackedData& key, Int64 rid, bool checksIntegrity)
 {
 	assert(rid != INVALID_RID);
+	// a unique key is checked in the same descent
+	if (checksIntegrity && !allowsDuplicate)
+		return insertUnique(key, rid).status == UniqueResult::Status::APPLIED;
+	if (hasFailed())
+		return false;
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(0, 1);
+	return applyInsert(key, rid, makeInternalKey(key, rid));
+}
+
+Index::UniqueResult Index::insertUnique(const PackedData& key, Int64 rid)
+{
+	assert(!allowsDuplicate && rid != INVALID_RID);
+	if (hasFailed())
+		return { UniqueResult::Status::FAILED, std::nullopt };
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(1, 1);
 
 	auto internalKey = makeInternalKey(key, rid);
+	auto conflict = findRid(internalKey);
+	if (conflict.has_value())
+		return { UniqueResult::Status::CONFLICT, conflict };
+	bool isCommitted = applyInsert(key, rid, std::move(internalKey));
+	return { isCommitted ? UniqueResult::Status::APPLIED : UniqueResult::Status::FAILED, std::nullopt };
+}
 
-	if(checksIntegrity && !allowsDuplicate && !select(internalKey).empty())
-		return false;
+Index::UniqueResult Index::upsert(const PackedData& key, Int64 rid)
+{
+	assert(!allowsDuplicate && rid != INVALID_RID);
+	if (hasFailed())
+		return { UniqueResult::Status::FAILED, std::nullopt };
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(1, 1);
+
+	auto internalKey = makeInternalKey(key, rid);
+	auto replaced = findRid(internalKey);
+	if (!replaced.has_value()) {
+		bool isCommitted = applyInsert(key, rid, std::move(internalKey));
+		return { isCommitted ? UniqueResult::Status::APPLIED : UniqueResult::Status::FAILED, std::nullopt };
+	}
+	if (*replaced == rid)
+		return { UniqueResult::Status::APPLIED, replaced };
+
+	// the removal of the old rid and the insertion of the new one go down together, as one batch of the log
+	auto lsn = logBatch({ key }, { rid }, { key }, { *replaced });
+	KeyValues kvsToInsert, kvsToRemove;
+	kvsToInsert.emplace_back(internalKey, rid);
+	kvsToRemove.emplace_back(std::move(internalKey), *replaced);
+	applyBatch(std::move(kvsToInsert), std::move(kvsToRemove));
+
+	bool isCommitted = commitLog(lsn);
+	return { isCommitted ? UniqueResult::Status::APPLIED : UniqueResult::Status::FAILED, replaced };
+}
+
+bool Index::applyInsert(const PackedData& key, Int64 rid, PackedData&& internalKey)
+{
+	WriteAheadLog::Lsn lsn = 0;
+	if (log != nullptr)
+		lsn = log->append(WriteAheadLog::RecordType::INSERT, key, rid);
 
 	std::vector<KeyValue> temp;
 	temp.push_back(KeyValue(std::move(internalKey), rid));
 	auto res = insert(root, std::move(temp));
 	maintainRoot(std::move(res));
 
-	return true;
+	return commitLog(lsn);
 }
 
-bool Index::insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegtrity) {
-	// todo: inserts multiple keys at once
-	// Result must be changed so that it can contain multiple kvs, and maintainRoot() must be changed as well
-
-	assert(false);
-	return true;
+bool Index::insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity)
+{
+	return update(keys, rids, {}, {}, checksIntegrity);
 }
 
 Index::Result Index::insert(Node* curr, std::vector<KeyValue>&& tempKvs)
 {
-	if (tempKvs.empty())
+	// a pushing parent also gives an overdue child its push, while the budget lasts
+	if (tempKvs.empty() && !(curr->isOverdue && pushBudget != 0))
 		return {};
+	fix(curr, true);
+	// only reads since the last write count toward compacting on read
+	curr->readCost = 0;
+	for (auto& kv : tempKvs) {
+		curr->count += isInvalid(kv) ? 0 : 1;
+		addToFilter(curr, kv);
+	}
 
 	curr->kvsToInsert.insert(curr->kvsToInsert.end(),
 		std::make_move_iterator(tempKvs.begin()),
@@ -74,30 +424,44 @@ Index::Result Index::insert(Node* curr, std::vector<KeyValue>&& tempKvs)
 bool Index::remove(const PackedData& key, Int64 rid, bool checksIntegrity)
 {
 	assert(rid != INVALID_RID);
+	if (hasFailed())
+		return false;
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(0, 1);
 
 	auto internalKey = makeInternalKey(key, rid);
 
 	if (checksIntegrity && !select(key, rid))
 		return false;
 
+	WriteAheadLog::Lsn lsn = 0;
+	if (log != nullptr)
+		lsn = log->append(WriteAheadLog::RecordType::REMOVE, key, rid);
+
 	std::vector<KeyValue> temp;
 	temp.push_back(KeyValue(std::move(internalKey), rid));
 	auto res = remove(root, std::move(temp));
 	maintainRoot(std::move(res));
 
-	return true;
+	return commitLog(lsn);
 }
 
-bool Index::remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegtrity) {
-	// todo: remove multiple keys at once
-	assert(false);
-	return true;
+bool Index::remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity)
+{
+	return update({}, {}, keys, rids, checksIntegrity);
 }
 
 Index::Result Index::remove(Node* curr, std::vector<KeyValue>&& tempKvs)
 {
-	if (tempKvs.empty())
+	if (tempKvs.empty() && !(curr->isOverdue && pushBudget != 0))
 		return {};
+	fix(curr, true);
+	curr->readCost = 0;
+	for (auto& kv : tempKvs) {
+		curr->count -= isInvalid(kv) ? 0 : 1;
+		addToFilter(curr, kv);
+	}
 
 	curr->kvsToRemove.insert(curr->kvsToRemove.end(),
 		std::make_move_iterator(tempKvs.begin()),
@@ -106,21 +470,892 @@ Index::Result Index::remove(Node* curr, std::vector<KeyValue>&& tempKvs)
 	return maintain(curr);
 }
 
+bool Index::update(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+	const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove, bool checksIntegrity)
+{
+	assert(keysToInsert.size() == ridsToInsert.size());
+	assert(keysToRemove.size() == ridsToRemove.size());
+	if (hasFailed())
+		return false;
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(0, (int)(keysToInsert.size() + keysToRemove.size()));
+
+	// every entry is checked against the tree as it was before the batch
+	if (checksIntegrity) {
+		if (!allowsDuplicate) {
+			for (auto& key : keysToInsert)
+				if (findRid(makeInternalKey(key, MIN_RID)).has_value())
+					return false;
+		}
+		for (int i = 0; i < (int)keysToRemove.size(); i++)
+			if (!select(keysToRemove[i], ridsToRemove[i]))
+				return false;
+	}
+
+	KeyValues kvsToInsert, kvsToRemove;
+	makeBatch(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove, kvsToInsert, kvsToRemove);
+	// and against itself: the sorted batch must not insert a key of a unique index, or a pair, twice,
+	// nor remove a pair twice
+	if (checksIntegrity && (hasRepeatedKeys(kvsToInsert, false) || hasRepeatedKeys(kvsToRemove, true)))
+		return false;
+	auto lsn = logBatch(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+	applyBatch(std::move(kvsToInsert), std::move(kvsToRemove));
+
+	return commitLog(lsn);
+}
+
+bool Index::hasRepeatedKeys(const KeyValues& kvs, bool comparesRid)
+{
+	const KeyValue* prev = nullptr;
+	for (auto& kv : kvs) {
+		// kvs cancelled out by makeBatch() stay in place as invalid
+		if (isInvalid(kv))
+			continue;
+		if (prev != nullptr && comparePackData(prev->key, kv.key) == 0 && (!comparesRid || prev->value.rid == kv.value.rid))
+			return true;
+		prev = &kv;
+	}
+	return false;
+}
+
+Index::PreparedUpdate Index::prepare(std::vector<PackedData>&& keysToInsert, std::vector<Int64>&& ridsToInsert,
+	std::vector<PackedData>&& keysToRemove, std::vector<Int64>&& ridsToRemove)
+{
+	assert(keysToInsert.size() == ridsToInsert.size());
+	assert(keysToRemove.size() == ridsToRemove.size());
+	PreparedUpdate update;
+	makeBatch(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove, update.kvsToInsert, update.kvsToRemove);
+	// the keys are kept for the log, whatever log is attached by the time of apply()
+	update.keysToInsert = std::move(keysToInsert);
+	update.ridsToInsert = std::move(ridsToInsert);
+	update.keysToRemove = std::move(keysToRemove);
+	update.ridsToRemove = std::move(ridsToRemove);
+	return update;
+}
+
+bool Index::apply(PreparedUpdate&& update)
+{
+	if (hasFailed())
+		return false;
+	Operation operation(this);
+	PushBudget budget(this);
+	observe(0, (int)(update.keysToInsert.size() + update.keysToRemove.size()));
+	auto lsn = logBatch(update.keysToInsert, update.ridsToInsert, update.keysToRemove, update.ridsToRemove);
+	applyBatch(std::move(update.kvsToInsert), std::move(update.kvsToRemove));
+
+	return commitLog(lsn);
+}
+
+bool Index::commitLog(WriteAheadLog::Lsn lsn)
+{
+	// lsn is 0 when nothing was logged, e.g., for a batch that cancelled out
+	bool isCommitted = log == nullptr || !commitsLog || lsn == 0 || log->commit(lsn);
+	return isCommitted && !hasStorageFailed();
+}
+
+void Index::makeBatch(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+	const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove,
+	KeyValues& kvsToInsert, KeyValues& kvsToRemove)
+{
+	kvsToInsert.reserve(keysToInsert.size());
+	for (int i = 0; i < (int)keysToInsert.size(); i++) {
+		assert(ridsToInsert[i] != INVALID_RID);
+		kvsToInsert.emplace_back(makeInternalKey(keysToInsert[i], ridsToInsert[i]), ridsToInsert[i]);
+	}
+	kvsToRemove.reserve(keysToRemove.size());
+	for (int i = 0; i < (int)keysToRemove.size(); i++) {
+		assert(ridsToRemove[i] != INVALID_RID);
+		kvsToRemove.emplace_back(makeInternalKey(keysToRemove[i], ridsToRemove[i]), ridsToRemove[i]);
+	}
+
+	// sort the batch once; a kv both inserted and removed in the same batch cancels out
+	removeDuplicate(kvsToInsert, kvsToRemove);
+}
+
+WriteAheadLog::Lsn Index::logBatch(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+	const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove)
+{
+	// the batch is one unit of the log, as the cancelling in makeBatch() does not depend on the order within it
+	WriteAheadLog::Lsn lsn = 0;
+	if (log == nullptr)
+		return lsn;
+	int remaining = (int)(keysToInsert.size() + keysToRemove.size());
+	for (int i = 0; i < (int)keysToInsert.size(); i++)
+		lsn = log->append(WriteAheadLog::RecordType::INSERT, keysToInsert[i], ridsToInsert[i], --remaining == 0);
+	for (int i = 0; i < (int)keysToRemove.size(); i++)
+		lsn = log->append(WriteAheadLog::RecordType::REMOVE, keysToRemove[i], ridsToRemove[i], --remaining == 0);
+	return lsn;
+}
+
+void Index::applyBatch(KeyValues&& kvsToInsert, KeyValues&& kvsToRemove)
+{
+	// drop the whole batch into the root buffers and let push() spread it down
+	fix(root, true);
+	root->readCost = 0;
+	for (auto& kv : kvsToInsert) {
+		root->count += isInvalid(kv) ? 0 : 1;
+		addToFilter(root, kv);
+	}
+	for (auto& kv : kvsToRemove) {
+		root->count -= isInvalid(kv) ? 0 : 1;
+		addToFilter(root, kv);
+	}
+	root->kvsToInsert.insert(root->kvsToInsert.end(),
+		std::make_move_iterator(kvsToInsert.begin()),
+		std::make_move_iterator(kvsToInsert.end()));
+	root->kvsToRemove.insert(root->kvsToRemove.end(),
+		std::make_move_iterator(kvsToRemove.begin()),
+		std::make_move_iterator(kvsToRemove.end()));
+	maintainRoot(maintain(root));
+}
+
+WriteAheadLog::Lsn Index::replay(const std::string& logPath)
+{
+	// whole batches of the log go through update() a few thousand records at a time
+	// -- replayed mutations are not logged again
+	constexpr int REPLAY_BATCH_SIZE = 4096;
+	auto attached = log;
+	log = nullptr;
+
+	std::vector<PackedData> keysToInsert, keysToRemove;
+	std::vector<Int64> ridsToInsert, ridsToRemove;
+	auto flush = [&]() {
+		update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+		keysToInsert.clear();
+		ridsToInsert.clear();
+		keysToRemove.clear();
+		ridsToRemove.clear();
+	};
+	auto last = WriteAheadLog::replay(logPath, [&](const WriteAheadLog::Record& record) {
+		// already in the checkpoint this index was opened from
+		if (record.lsn <= appliedLsn)
+			return;
+		if (record.type == WriteAheadLog::RecordType::INSERT) {
+			keysToInsert.push_back(record.key);
+			ridsToInsert.push_back(record.rid);
+		}
+		else {
+			keysToRemove.push_back(record.key);
+			ridsToRemove.push_back(record.rid);
+		}
+		if (record.endsBatch && (int)(keysToInsert.size() + keysToRemove.size()) >= REPLAY_BATCH_SIZE)
+			flush();
+	});
+	flush();
+
+	log = attached;
+	appliedLsn = std::max(appliedLsn, last);
+	return last;
+}
+
 bool Index::select(const PackedData& key, Int64 rid)
 {
+	Operation operation(this);
+	observe(1, 0);
 	auto res = select(makeInternalKey(key, rid), makeInternalKey(key, rid));
 	assert(res.size() <= 1);
-	return !res.empty();
+	// the internal key of a unique index leaves the rid out
+	return !res.empty() && (allowsDuplicate || res.front() == rid);
 }
 
 std::vector<int> Index::select(const PackedData& key)
 {
+	Operation operation(this);
+	observe(1, 0);
 	return select(makeInternalKey(key, MIN_RID), makeInternalKey(key, MAX_RID));
 }
 
 std::vector<int> Index::selectRange(const PackedData& loKey, const PackedData& hiKey)
 {
-	return select(makeInternalKey(loKey, MIN_RID), makeInternalKey(hiKey, MAX_RID));
+	Operation operation(this);
+	observe(1, 0);
+	auto hi = makeInternalKey(hiKey, MAX_RID);
+	std::vector<int> res;
+	auto cursor = Cursor(this);
+	for (cursor.seek(loKey); cursor.valid(); cursor.next()) {
+		if (comparePackData(cursor.internalKey(), hi) > 0)
+			break;
+		res.push_back((int)cursor.rid());
+	}
+	return res;
+}
+
+void Index::setLazySize(int lazySize)
+{
+	assert(lazySize >= 1);
+	// buffers over the new size are pushed down as their nodes are visited
+	maxLazySize = std::min(lazySize, maxBranchingFactor);
+}
+
+void Index::observe(int numReads, int numWrites)
+{
+	if (!adaptsLazySize)
+		return;
+	numReadsSeen += numReads;
+	numWritesSeen += numWrites;
+	if (numReadsSeen + numWritesSeen < ADAPT_WINDOW)
+		return;
+
+	// a kv buffered at a node costs each select passing by one comparison, and saves a push of about
+	// maxBranchingFactor / lazySize work per kv; the total is the least at sqrt(maxBranchingFactor * writes / reads),
+	// which is the default sqrt(maxBranchingFactor) for an even mix
+	double ratio = (double)(numWritesSeen + 1) / (numReadsSeen + 1);
+	setLazySize(std::max(1, (int)std::lround(std::sqrt(maxBranchingFactor * ratio))));
+	// older windows weigh less and less
+	numReadsSeen /= 2;
+	numWritesSeen /= 2;
+}
+
+Index::SelectManyResult Index::selectMany(const std::vector<PackedData>& keys)
+{
+	Operation operation(this);
+	observe((int)keys.size(), 0);
+
+	// one probe [lo, hi] per distinct key, in key order; probes of distinct keys do not overlap
+	int n = (int)keys.size();
+	std::vector<PackedData> los(n);
+	for (int i = 0; i < n; i++)
+		los[i] = makeInternalKey(keys[i], MIN_RID);
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](int i, int j) { return comparePackData(los[i], los[j]) < 0; });
+	std::vector<int> probeOf(n);
+	std::vector<PackedData> probeLos, probeHis;
+	for (int i = 0; i < n; i++) {
+		if (probeLos.empty() || comparePackData(probeLos.back(), los[order[i]]) != 0) {
+			probeLos.push_back(std::move(los[order[i]]));
+			probeHis.push_back(makeInternalKey(keys[order[i]], MAX_RID));
+		}
+		probeOf[order[i]] = (int)probeLos.size() - 1;
+	}
+
+	// a level at a time: prefetch the nodes of the level and then their kvs, before searching any of them
+	std::vector<std::pair<int, int>> plus, minus;
+	std::vector<ProbeRange> level, next;
+	if (!probeLos.empty())
+		level.push_back({ root, 0, (int)probeLos.size() });
+	while (!level.empty()) {
+		if (bufferPool == nullptr) {
+			for (auto& range : level)
+				prefetch(range.node);
+			for (auto& range : level) {
+				prefetch(range.node->prefixes.data());
+				prefetch(range.node->kvs.data());
+			}
+		}
+		for (auto& range : level) {
+			int mark = (int)pinnedNodes.size();
+			selectMany(range, probeLos, probeHis, plus, minus, next);
+			unpinFrom(mark);
+		}
+		level.swap(next);
+		next.clear();
+	}
+	if (hasHotNodes)
+		pushHotNodes();
+
+	// the balance of select() per probe
+	std::sort(plus.begin(), plus.end());
+	std::sort(minus.begin(), minus.end());
+	std::vector<std::vector<int>::size_type> probeFrom(probeLos.size() + 1);
+	std::vector<int> probeRids;
+	auto itm = minus.begin();
+	for (auto itp = plus.begin(); itp != plus.end(); itp++) {
+		while (itm != minus.end() && *itm < *itp)
+			itm++;
+		if (itm != minus.end() && *itm == *itp) {
+			itm++;
+			continue;
+		}
+		probeRids.push_back(itp->second);
+		probeFrom[itp->first + 1]++;
+	}
+	for (int p = 0; p < (int)probeLos.size(); p++)
+		probeFrom[p + 1] += probeFrom[p];
+
+	SelectManyResult res;
+	res.offsets.resize(n + 1);
+	for (int i = 0; i < n; i++) {
+		int p = probeOf[i];
+		res.offsets[i + 1] = res.offsets[i] + (int)(probeFrom[p + 1] - probeFrom[p]);
+	}
+	res.rids.reserve(res.offsets[n]);
+	for (int i = 0; i < n; i++) {
+		int p = probeOf[i];
+		res.rids.insert(res.rids.end(), probeRids.begin() + probeFrom[p], probeRids.begin() + probeFrom[p + 1]);
+	}
+	return res;
+}
+
+void Index::selectMany(const ProbeRange& range, const std::vector<PackedData>& los, const std::vector<PackedData>& his,
+	std::vector<std::pair<int, int>>& plus, std::vector<std::pair<int, int>>& minus, std::vector<ProbeRange>& next)
+{
+	Node* curr = range.node;
+	fix(curr);
+	int cost = (int)(curr->kvsUnsorted.size() + curr->kvsToInsert.size() + curr->kvsToRemove.size());
+	auto losBegin = los.begin() + range.from;
+	auto losEnd = los.begin() + range.to;
+	// the probe whose range holds key, or -1
+	auto probeOf = [&](const PackedData& key) {
+		auto it = std::partition_point(losBegin, losEnd, [&](const PackedData& lo) { return comparePackData(lo, key) <= 0; });
+		if (it == losBegin)
+			return -1;
+		int p = (int)(it - los.begin()) - 1;
+		return comparePackData(key, his[p]) <= 0 ? p : -1;
+	};
+	auto collect = [&](const KeyValues& kvs, std::vector<std::pair<int, int>>& pairs) {
+		for (auto& kv : kvs) {
+			if (isInvalid(kv))
+				continue;
+			int p = probeOf(kv.key);
+			if (p >= 0)
+				pairs.emplace_back(p, (int)kv.value.rid);
+		}
+	};
+	collect(curr->kvsToInsert, plus);
+	collect(curr->kvsToRemove, minus);
+
+	if (curr->isLeaf) {
+		int hint = 0;
+		for (int p = range.from; p < range.to; p++) {
+			auto it = lowerBound(curr, los[p], hint);
+			hint = (int)(it - curr->kvs.begin());
+			for (; it != curr->kvs.end() && comparePackData(it->key, his[p]) <= 0; it++) {
+				if (isInvalid(*it)) {
+					cost++;
+					continue;
+				}
+				plus.emplace_back(p, (int)it->value.rid);
+			}
+		}
+		collect(curr->kvsUnsorted, plus);
+	}
+	else {
+		// children of kvs each probe goes through, as in select(); consecutive probes may share a child
+		int numProbes = range.to - range.from;
+		std::vector<int> froms(numProbes), tos(numProbes);
+		int hint = 0;
+		for (int i = 0; i < numProbes; i++) {
+			auto from = upperBound(curr, los[range.from + i], hint);
+			auto to = upperBound(curr, his[range.from + i], (int)(from - curr->kvs.begin()));
+			assert(to != curr->kvs.end());
+			froms[i] = (int)(from - curr->kvs.begin());
+			tos[i] = (int)(to - curr->kvs.begin());
+			hint = froms[i];
+		}
+		int last = -1;
+		for (int i = 0; i < numProbes; i++) {
+			for (int c = std::max(froms[i], last + 1); c <= tos[i]; c++) {
+				int j = i + 1;
+				while (j < numProbes && froms[j] <= c)
+					j++;
+				if (isInvalid(curr->kvs[c]))
+					cost++;
+				else
+					next.push_back({ curr->kvs[c].value.child, range.from + i, range.from + j });
+				last = c;
+			}
+		}
+		// a child in kvsUnsorted lies within the children of kvs of the probes with lo < its key <= kvs[to]
+		for (auto& kv : curr->kvsUnsorted) {
+			if (isInvalid(kv))
+				continue;
+			int i = (int)(std::partition_point(tos.begin(), tos.end(),
+				[&](int to) { return comparePackData(kv.key, curr->kvs[to].key) > 0; }) - tos.begin());
+			int j = (int)(std::partition_point(losBegin, losEnd,
+				[&](const PackedData& lo) { return comparePackData(kv.key, lo) > 0; }) - losBegin);
+			if (i < j)
+				next.push_back({ kv.value.child, range.from + i, range.from + j });
+		}
+	}
+
+	if (readCompactionThreshold > 0 && cost > 0)
+		countReadCost(curr, cost);
+}
+
+Int64 Index::count(const PackedData& loKey, const PackedData& hiKey)
+{
+	Operation operation(this);
+	observe(1, 0);
+	auto res = countLess(makeInternalKey(hiKey, MAX_RID), true) - countLess(makeInternalKey(loKey, MIN_RID), false);
+	return std::max(res, (Int64)0);
+}
+
+Int64 Index::rank(const PackedData& key)
+{
+	Operation operation(this);
+	observe(1, 0);
+	return countLess(makeInternalKey(key, MIN_RID), false);
+}
+
+Int64 Index::countLess(const PackedData& key, bool inclusive)
+{
+	// along the path to key, add the buffered pairs before key and the counts of the children wholly before key
+	auto isBefore = [&](const PackedData& other) {
+		int cmp = comparePackData(other, key);
+		return cmp < 0 || (inclusive && cmp == 0);
+	};
+	Int64 res = 0;
+	Node* curr = root;
+	while (true) {
+		fix(curr);
+		for (auto& kv : curr->kvsToInsert)
+			res += !isInvalid(kv) && isBefore(kv.key) ? 1 : 0;
+		for (auto& kv : curr->kvsToRemove)
+			res -= !isInvalid(kv) && isBefore(kv.key) ? 1 : 0;
+		if (curr->isLeaf)
+			break;
+
+		// a child holds the keys below its own and from the one of the child before it
+		auto it = upperBound(curr, key);
+		for (auto before = curr->kvs.begin(); before != it; before++)
+			res += isInvalid(*before) ? 0 : before->value.child->count;
+		while (it != curr->kvs.end() && isInvalid(*it))
+			it++;
+		assert(it != curr->kvs.end());
+		KeyValue* chosen = &*it;
+		for (auto& kv : curr->kvsUnsorted) {
+			if (isInvalid(kv))
+				continue;
+			if (comparePackData(kv.key, key) <= 0)
+				res += kv.value.child->count;
+			else if (comparePackData(kv.key, chosen->key) < 0)
+				chosen = &kv;
+		}
+		curr = chosen->value.child;
+	}
+
+	// a leaf holding no invalidated kvs, as after its last compaction, is counted by the binary search alone
+	auto end = inclusive ? upperBound(curr, key) : lowerBound(curr, key);
+	if ((int)(curr->kvs.size() + curr->kvsUnsorted.size()) == curr->numKvs)
+		res += end - curr->kvs.begin();
+	else
+		for (auto it = curr->kvs.begin(); it != end; it++)
+			res += isInvalid(*it) ? 0 : 1;
+	for (auto& kv : curr->kvsUnsorted)
+		res += !isInvalid(kv) && isBefore(kv.key) ? 1 : 0;
+	return res;
+}
+
+std::optional<std::pair<PackedData, Int64>> Index::nth(Int64 k)
+{
+	Operation operation(this);
+	observe(1, 0);
+	if (k < 0 || k >= root->count)
+		return std::nullopt;
+	return findNth(k);
+}
+
+std::vector<std::pair<PackedData, Int64>> Index::sample(const PackedData& loKey, const PackedData& hiKey, int k,
+	unsigned seed)
+{
+	Operation operation(this);
+	observe(1, 0);
+	Int64 from = countLess(makeInternalKey(loKey, MIN_RID), false);
+	Int64 to = countLess(makeInternalKey(hiKey, MAX_RID), true);
+	Int64 n = std::max(to - from, (Int64)0);
+	k = (int)std::min((Int64)std::max(k, 0), n);
+
+	// k distinct positions of [0, n) by Floyd's algorithm, then one descent each
+	std::mt19937_64 random(seed);
+	std::unordered_set<Int64> chosen;
+	for (Int64 j = n - k; j < n; j++) {
+		Int64 t = std::uniform_int_distribution<Int64>(0, j)(random);
+		chosen.insert(chosen.count(t) ? j : t);
+	}
+	std::vector<Int64> positions(chosen.begin(), chosen.end());
+	std::sort(positions.begin(), positions.end());
+
+	std::vector<std::pair<PackedData, Int64>> res;
+	res.reserve(k);
+	for (auto position : positions)
+		res.push_back(findNth(from + position));
+	return res;
+}
+
+std::pair<PackedData, Int64> Index::findNth(Int64 k)
+{
+	// buffered pairs of curr and the nodes above that fall into the subtree of curr
+	struct Entry {
+		const PackedData* key;
+		Int64 rid;
+		int sign;
+	};
+	auto cmp = [this](const Entry& e1, const Entry& e2) { return comparePackData(*e1.key, *e2.key) < 0; };
+	std::vector<Entry> pending;
+	Node* curr = root;
+	while (true) {
+		fix(curr);
+		for (auto& kv : curr->kvsToInsert)
+			if (!isInvalid(kv))
+				pending.push_back({ &kv.key, kv.value.rid, 1 });
+		for (auto& kv : curr->kvsToRemove)
+			if (!isInvalid(kv))
+				pending.push_back({ &kv.key, kv.value.rid, -1 });
+		if (curr->isLeaf)
+			break;
+
+		// walk the children in key order, each holding its count plus the pending pairs in its range
+		std::vector<KeyValue*> children;
+		for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+			for (auto& kv : *kvs)
+				if (!isInvalid(kv))
+					children.push_back(&kv);
+		std::sort(children.begin(), children.end(), [this](KeyValue* kv1, KeyValue* kv2) { return compareKeyValue(*kv1, *kv2); });
+		std::sort(pending.begin(), pending.end(), cmp);
+		int from = 0;
+		for (auto child : children) {
+			int to = from;
+			Int64 n = child->value.child->count;
+			while (to < (int)pending.size() && (child->key.get() == nullptr || comparePackData(*pending[to].key, child->key) < 0))
+				n += pending[to++].sign;
+			if (k < n) {
+				pending = std::vector<Entry>(pending.begin() + from, pending.begin() + to);
+				curr = child->value.child;
+				break;
+			}
+			k -= n;
+			from = to;
+		}
+	}
+
+	// the pairs of the leaf with the pending ones; a pair is live if its insertions outnumber its removals
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+		for (auto& kv : *kvs)
+			if (!isInvalid(kv))
+				pending.push_back({ &kv.key, kv.value.rid, 1 });
+	std::sort(pending.begin(), pending.end(), [this](const Entry& e1, const Entry& e2) {
+		int cmp = comparePackData(*e1.key, *e2.key);
+		return cmp < 0 || (cmp == 0 && e1.rid < e2.rid);
+	});
+	for (int i = 0; i < (int)pending.size();) {
+		int balance = 0;
+		int j = i;
+		for (; j < (int)pending.size() && comparePackData(*pending[j].key, *pending[i].key) == 0 && pending[j].rid == pending[i].rid; j++)
+			balance += pending[j].sign;
+		assert(balance == 0 || balance == 1);
+		if (balance == 1 && k-- == 0)
+			return std::make_pair(makeUserKey(*pending[i].key), pending[i].rid);
+		i = j;
+	}
+	assert(false);
+	return {};
+}
+
+std::optional<Int64> Index::findRid(const PackedData& key)
+{
+	// the pairs with key on the path down to the leaf covering it, as in Cursor::load(), with their signs
+	std::vector<std::pair<Int64, int>> pairs;
+	auto collect = [&](const KeyValues& kvs, int sign) {
+		for (auto& kv : kvs)
+			if (!isInvalid(kv) && comparePackData(kv.key, key) == 0)
+				pairs.emplace_back(kv.value.rid, sign);
+	};
+	std::optional<std::uint64_t> keyHash;
+	if (usesFilters)
+		keyHash = hashUserKey(key);
+
+	Node* curr = root;
+	while (true) {
+		fix(curr);
+		bool mayHold = !keyHash.has_value() || mayContain(curr, *keyHash);
+		if (mayHold) {
+			collect(curr->kvsToInsert, 1);
+			collect(curr->kvsToRemove, -1);
+		}
+		if (curr->isLeaf) {
+			if (mayHold) {
+				for (auto it = lowerBound(curr, key); it != curr->kvs.end(); it++) {
+					if (isInvalid(*it))
+						continue;
+					if (comparePackData(it->key, key) != 0)
+						break;
+					pairs.emplace_back(it->value.rid, 1);
+				}
+				collect(curr->kvsUnsorted, 1);
+			}
+			break;
+		}
+		auto it = upperBound(curr, key);
+		while (it != curr->kvs.end() && isInvalid(*it))
+			it++;
+		assert(it != curr->kvs.end());
+		KeyValue* chosen = &*it;
+		for (auto& kv : curr->kvsUnsorted) {
+			if (isInvalid(kv))
+				continue;
+			if (comparePackData(kv.key, key) > 0 && comparePackData(kv.key, chosen->key) < 0)
+				chosen = &kv;
+		}
+		curr = chosen->value.child;
+	}
+
+	// the live rid is the one inserted once more than removed
+	for (auto [rid, sign] : pairs) {
+		if (sign < 0)
+			continue;
+		int balance = 0;
+		for (auto [other, otherSign] : pairs)
+			balance += other == rid ? otherSign : 0;
+		assert(balance == 0 || balance == 1);
+		if (balance == 1)
+			return rid;
+	}
+	return std::nullopt;
+}
+
+void Index::useFilters(bool uses)
+{
+	Operation operation(this);
+	// the filters are not kept up while off, so they are built afresh
+	usesFilters = uses;
+	rebuildFilters(root);
+}
+
+std::uint64_t Index::hashUserKey(const PackedData& key)
+{
+	return hashBytes(static_cast<const std::byte*>(key.get()), key.size() - (allowsDuplicate ? (int)sizeof(Int64) : 0));
+}
+
+void Index::rebuildFilter(Node* curr)
+{
+	if (!usesFilters) {
+		std::vector<std::uint64_t>().swap(curr->filter);
+		return;
+	}
+	int numBits = (maxBranchingFactor + reservedLazySize * 2) * FILTER_BITS_PER_KEY;
+	curr->filter.assign((numBits + 63) / 64, 0);
+	for (auto kvs : { &curr->kvsToInsert, &curr->kvsToRemove })
+		for (auto& kv : *kvs)
+			addToFilter(curr, kv);
+	if (curr->isLeaf) {
+		for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+			for (auto& kv : *kvs)
+				addToFilter(curr, kv);
+	}
+}
+
+void Index::rebuildFilters(Node* curr)
+{
+	fix(curr);
+	rebuildFilter(curr);
+	if (curr->isLeaf)
+		return;
+	int mark = (int)pinnedNodes.size();
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted }) {
+		for (auto& kv : *kvs) {
+			if (isInvalid(kv))
+				continue;
+			rebuildFilters(kv.value.child);
+			unpinFrom(mark);
+		}
+	}
+}
+
+void Index::addToFilter(Node* curr, const KeyValue& kv)
+{
+	if (curr->filter.empty() || isInvalid(kv))
+		return;
+	auto hash = hashUserKey(kv.key);
+	curr->filter[((hash & 0xFFFFFFFFull) * curr->filter.size()) >> 32] |= filterMask(hash);
+}
+
+bool Index::mayContain(Node* curr, std::uint64_t hash)
+{
+	if (curr->filter.empty())
+		return true;
+	auto mask = filterMask(hash);
+	return (curr->filter[((hash & 0xFFFFFFFFull) * curr->filter.size()) >> 32] & mask) == mask;
+}
+
+Int64 Index::computeCount(Node* curr)
+{
+	Int64 res = 0;
+	for (auto& kv : curr->kvsToInsert)
+		res += isInvalid(kv) ? 0 : 1;
+	for (auto& kv : curr->kvsToRemove)
+		res -= isInvalid(kv) ? 0 : 1;
+	if (curr->isLeaf)
+		return res + curr->numKvs;
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+		for (auto& kv : *kvs)
+			res += isInvalid(kv) ? 0 : kv.value.child->count;
+	return res;
+}
+
+int Index::maintainPending(int maxNodes)
+{
+	if (hasStorageFailed())
+		return 0;
+	Operation operation(this);
+	auto defers = defersMaintenance;
+	defersMaintenance = false;
+	int numNodes = 0;
+
+	// the root buffers first: maintain() pushes them down as a foreground operation would have
+	fix(root);
+	if ((int)root->kvsToInsert.size() > maxLazySize || (int)root->kvsToRemove.size() > maxLazySize) {
+		maintainRoot(maintain(root));
+		numNodes++;
+	}
+
+	// then compact nodes along paths, merging kvsUnsorted and dropping invalidated kvs
+	for (int path = 0; path < maxNodes && numNodes < maxNodes; path++) {
+		int mark = (int)pinnedNodes.size();
+		Node* curr = root;
+		while (true) {
+			fix(curr);
+			if (!curr->kvsUnsorted.empty() || (int)curr->kvs.size() != curr->numKvs) {
+				fix(curr, true);
+				sortKvs(curr);
+				numNodes++;
+			}
+			if (curr->isLeaf || numNodes >= maxNodes)
+				break;
+			// curr is compact now, so every child is a valid kv of kvs
+			// -- the sizes of a paged-out child are unknown without loading it, so only loaded children compete
+			Node* next = nullptr;
+			double worstRatio = 0;
+			for (auto& kv : curr->kvs) {
+				assert(!isInvalid(kv));
+				auto child = kv.value.child;
+				if (bufferPool != nullptr && child->frame < 0)
+					continue;
+				int size = (int)(child->kvs.size() + child->kvsUnsorted.size());
+				// invalidated kvs, and unsorted ones still to be merged
+				int numDirty = size - child->numKvs + (int)child->kvsUnsorted.size();
+				double ratio = size == 0 ? 0 : (double)numDirty / size;
+				if (ratio > worstRatio) {
+					worstRatio = ratio;
+					next = child;
+				}
+			}
+			if (next == nullptr)
+				next = curr->kvs[sweepRandom() % curr->kvs.size()].value.child;
+			curr = next;
+		}
+		unpinFrom(mark);
+	}
+
+	defersMaintenance = defers;
+	return numNodes;
+}
+
+Index::Cursor Index::cursor()
+{
+	return Cursor(this);
+}
+
+void Index::Cursor::seek(const PackedData& key)
+{
+	load(index->makeInternalKey(key, MIN_RID));
+}
+
+void Index::Cursor::next()
+{
+	pos++;
+	if (pos == (int)window.size() && ub.get() != nullptr)
+		load(ub);
+}
+
+PackedData Index::Cursor::key() const
+{
+	return index->makeUserKey(internalKey());
+}
+
+void Index::Cursor::load(PackedData lo)
+{
+	// same balance as select(): +1 for kvs of the leaf and kvsToInsert, -1 for kvsToRemove
+	struct Entry {
+		const PackedData* key;
+		Int64 rid;
+		int sign;
+	};
+	auto cmp = [this](const PackedData& data1, const PackedData& data2) {
+		return index->comparePackData(data1, data2);
+	};
+
+	// the nodes on the path stay pinned while entries point into them
+	Operation operation(index);
+	window.clear();
+	pos = 0;
+	while (true) {
+		std::vector<Entry> entries;
+		auto collect = [&](const KeyValues& kvs, int sign) {
+			for (auto& kv : kvs) {
+				if (isInvalid(kv) || cmp(kv.key, lo) < 0)
+					continue;
+				entries.push_back({ &kv.key, kv.value.rid, sign });
+			}
+		};
+
+		// descend to the leaf covering lo, narrowing its upper bound on the way
+		Node* curr = index->root;
+		const PackedData* ubKey = nullptr;
+		while (true) {
+			index->fix(curr);
+			collect(curr->kvsToInsert, 1);
+			collect(curr->kvsToRemove, -1);
+			if (curr->isLeaf)
+				break;
+			auto it = index->upperBound(curr, lo);
+			while (it != curr->kvs.end() && isInvalid(*it))
+				it++;
+			assert(it != curr->kvs.end());
+			KeyValue* chosen = &*it;
+			for (auto& kv : curr->kvsUnsorted) {
+				if (isInvalid(kv))
+					continue;
+				if (cmp(kv.key, lo) > 0 && cmp(kv.key, chosen->key) < 0)
+					chosen = &kv;
+			}
+			if (chosen->key.get() != nullptr && (ubKey == nullptr || cmp(chosen->key, *ubKey) < 0))
+				ubKey = &chosen->key;
+			curr = chosen->value.child;
+		}
+		for (auto it = index->lowerBound(curr, lo); it != curr->kvs.end(); it++) {
+			if (isInvalid(*it))
+				continue;
+			entries.push_back({ &it->key, it->value.rid, 1 });
+		}
+		collect(curr->kvsUnsorted, 1);
+
+		if (ubKey != nullptr) {
+			entries.erase(std::remove_if(entries.begin(), entries.end(),
+				[&](const Entry& entry) {return cmp(*entry.key, *ubKey) >= 0; }), entries.end());
+		}
+		std::sort(entries.begin(), entries.end(),
+			[&](const Entry& entry1, const Entry& entry2) {return cmp(*entry1.key, *entry2.key) < 0; });
+		for (int i = 0, j = 0; i < (int)entries.size(); i = j) {
+			int balance = 0;
+			for (; j < (int)entries.size() && cmp(*entries[i].key, *entries[j].key) == 0; j++)
+				balance += entries[j].sign;
+			assert(balance == 0 || balance == 1 || index->hasStorageFailed());
+			// in a unique index, the key may have been inserted with other rids since removed
+			Int64 rid = INVALID_RID;
+			for (int k = i; k < j && balance == 1; k++) {
+				int ridBalance = 0;
+				for (int l = i; l < j; l++)
+					ridBalance += entries[l].rid == entries[k].rid ? entries[l].sign : 0;
+				if (ridBalance == 1)
+					rid = entries[k].rid;
+			}
+			if (balance == 1)
+				window.emplace_back(*entries[i].key, rid);
+		}
+
+		if (ubKey == nullptr) {
+			ub.reset();
+			return;
+		}
+		ub = *ubKey;
+		if (!window.empty())
+			return;
+		// every pair of this leaf is removed; move on to the next leaf
+		lo = ub;
+	}
 }
 
 std::vector<int> Index::select(const PackedData& loKey, const PackedData& hiKey) {
@@ -130,8 +1365,16 @@ std::vector<int> Index::select(const PackedData& loKey, const PackedData& hiKey)
 	// 3) -1 for keys in kvsToRemove of any node
 	// -- the balance must be 1 or 0
 
+	// loKey and hiKey of one user key make an equal search, which may skip nodes by their filters
+	std::optional<std::uint64_t> keyHash;
+	int userKeySize = loKey.size() - (allowsDuplicate ? (int)sizeof(Int64) : 0);
+	if (usesFilters && loKey.size() == hiKey.size() && std::memcmp(loKey.get(), hiKey.get(), userKeySize) == 0)
+		keyHash = hashUserKey(loKey);
+
 	std::vector<int> plus, minus;
-	select(root, loKey, hiKey, plus, minus);
+	select(root, loKey, hiKey, plus, minus, keyHash);
+	if (hasHotNodes)
+		pushHotNodes();
 
 	std::sort(plus.begin(), plus.end());
 	std::sort(minus.begin(), minus.end());
@@ -149,25 +1392,33 @@ std::vector<int> Index::select(const PackedData& loKey, const PackedData& hiKey)
 			itm++;
 		}
 		else {
-			assert(false);
+			// a removal whose pair was lost with a node that could not be read
+			assert(hasStorageFailed());
+			itm++;
 		}
 	}
-	assert(itm == minus.end());
+	assert(itm == minus.end() || hasStorageFailed());
 	return res;
 }
 
-void Index::select(Node* curr, const PackedData& loKey, const PackedData& hiKey, std::vector<int>& plus, std::vector<int>& minus)
+void Index::select(Node* curr, const PackedData& loKey, const PackedData& hiKey, std::vector<int>& plus, std::vector<int>& minus,
+	std::optional<std::uint64_t> keyHash)
 {
-	// todo: make some statistics for select to enhance the searching time
-	// e.g., if # invalid call exceeds a certain number
-	// just sort the whole kvs so as to remove unsorted kvs and invalid kvs
-
+	fix(curr);
+	// the filter covers the buffers, and kvs and kvsUnsorted of a leaf, but not the children
+	bool mayHold = !keyHash.has_value() || mayContain(curr, *keyHash);
+	if (!mayHold && curr->isLeaf)
+		return;
+	// entries scanned linearly or skipped as invalid, which a compact node would not cost
+	int cost = (int)(curr->kvsUnsorted.size() + (mayHold ? curr->kvsToInsert.size() + curr->kvsToRemove.size() : 0));
 	if (curr->isLeaf) {
 		auto from = lowerBound(curr, loKey);
 		auto to = upperBound(curr, hiKey, from - curr->kvs.begin());
 		for (auto it = from; it != to; it++) {
-			if (isInvalid(*it))
+			if (isInvalid(*it)) {
+				cost++;
 				continue;
+			}
 			plus.push_back(it->value.rid);
 		}
 		for (auto& kv : curr->kvsUnsorted) {
@@ -183,10 +1434,14 @@ void Index::select(Node* curr, const PackedData& loKey, const PackedData& hiKey,
 		auto to = upperBound(curr, hiKey, from - curr->kvs.begin());
 		assert(to != curr->kvs.end());
 		to++;
+		int mark = (int)pinnedNodes.size();
 		for (auto it = from; it != to; it++) {
-			if (isInvalid(*it))
+			if (isInvalid(*it)) {
+				cost++;
 				continue;
-			select(it->value.child, loKey, hiKey, plus, minus);
+			}
+			select(it->value.child, loKey, hiKey, plus, minus, keyHash);
+			unpinFrom(mark);
 		}
 		to--;
 		for (auto& kv : curr->kvsUnsorted) {
@@ -195,28 +1450,65 @@ void Index::select(Node* curr, const PackedData& loKey, const PackedData& hiKey,
 			// hiKey < kvs[to] < kv.key -> kv's interval is larger than kvs[to]
 			if (comparePackData(kv.key, to->key) > 0)
 				continue;
-			if (comparePackData(kv.key, loKey) > 0)
-				select(kv.value.child, loKey, hiKey, plus, minus);
+			if (comparePackData(kv.key, loKey) > 0) {
+				select(kv.value.child, loKey, hiKey, plus, minus, keyHash);
+				unpinFrom(mark);
+			}
 		}
 	}
 
-	for (auto& kv : curr->kvsToInsert) {
-		if (isInvalid(kv))
-			continue;
-		if (comparePackData(kv.key, loKey) >= 0 && comparePackData(kv.key, hiKey) <= 0)
-			plus.push_back(kv.value.rid);
+	if (mayHold) {
+		for (auto& kv : curr->kvsToInsert) {
+			if (isInvalid(kv))
+				continue;
+			if (comparePackData(kv.key, loKey) >= 0 && comparePackData(kv.key, hiKey) <= 0)
+				plus.push_back(kv.value.rid);
+		}
+		for (auto& kv : curr->kvsToRemove) {
+			if (isInvalid(kv))
+				continue;
+			if (comparePackData(kv.key, loKey) >= 0 && comparePackData(kv.key, hiKey) <= 0)
+				minus.push_back(kv.value.rid);
+		}
+	}
+
+	if (readCompactionThreshold > 0 && cost > 0)
+		countReadCost(curr, cost);
+}
+
+void Index::countReadCost(Node* curr, int cost)
+{
+	curr->readCost += cost;
+	if (curr->readCost < readCompactionThreshold)
+		return;
+	curr->readCost = 0;
+	// no iterator of the caller points into curr, so it is compacted right away
+	if (!curr->kvsUnsorted.empty() || (int)curr->kvs.size() != curr->numKvs) {
+		fix(curr, true);
+		sortKvs(curr);
 	}
-	for (auto& kv : curr->kvsToRemove) {
-		if (isInvalid(kv))
-			continue;
-		if (comparePackData(kv.key, loKey) >= 0 && comparePackData(kv.key, hiKey) <= 0)
-			minus.push_back(kv.value.rid);
+	// pushing the buffers changes the tree above curr, which waits until the select is done
+	if (!curr->kvsToInsert.empty() || !curr->kvsToRemove.empty()) {
+		curr->isHot = true;
+		markOverdue(curr);
+		hasHotNodes = true;
+	}
+}
+
+void Index::pushHotNodes()
+{
+	hasHotNodes = false;
+	PushBudget budget(this);
+	// with a push budget, the guard pays what it can and carries the rest forward
+	if (pushBudget < 0) {
+		while (root->isOverdue || root->hasOverdueBelow)
+			maintainRoot(payOverdue(root));
 	}
 }
 
 void Index::sortKvs(Node* curr)
 {
-	if (curr->kvsUnsorted.empty() && curr->kvs.size() == curr->numKvs)
+	if (curr->kvsUnsorted.empty() && (int)curr->kvs.size() == curr->numKvs)
 		return;
 
 	auto cmp = std::bind(&Index::compareKeyValue, this, std::placeholders::_1, std::placeholders::_2);
@@ -241,19 +1533,35 @@ void Index::sortKvs(Node* curr)
 	if (!curr->isLeaf) {
 		for (auto it = curr->kvs.begin(); it != curr->kvs.end(); it++) {
 			assert(!isInvalid(*it));
-			it->value.child->parentIt = it;
+			linkChild(curr, it);
 		}
 	}
+	updatePrefixes(curr);
+	// kvs invalidated in a leaf are gone now
+	if (curr->isLeaf)
+		rebuildFilter(curr);
 
-	assert(curr->kvs.size() == curr->numKvs);
+	assert((int)curr->kvs.size() == curr->numKvs);
 	assert(curr->kvsUnsorted.size() == 0);
+	settle(curr);
+}
+
+void Index::settle(Node* curr)
+{
+	if (!curr->relayout(maxBranchingFactor, reservedLazySize) || curr->isLeaf)
+		return;
+	// the children point at their kvs through parentIt
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+		for (auto it = kvs->begin(); it != kvs->end(); it++)
+			if (!isInvalid(*it))
+				linkChild(curr, it);
 }
 
-void Index::removeDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValue>& kvs2)
+void Index::removeDuplicate(KeyValues& kvs1, KeyValues& kvs2)
 {
 	invalidateDuplicate(kvs1, kvs2);
 
-	auto removeInvalidated = [](std::vector<KeyValue>& kvs) {
+	auto removeInvalidated = [](KeyValues& kvs) {
 		auto it = kvs.begin();
 		auto it2 = kvs.begin();
 		while (it2 != kvs.end()) {
@@ -273,7 +1581,7 @@ void Index::removeDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValue>&
 		kvs2.pop_back();
 }
 
-void Index::invalidateDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValue>& kvs2)
+void Index::invalidateDuplicate(KeyValues& kvs1, KeyValues& kvs2)
 {
 	std::sort(kvs1.begin(), kvs1.end(),
 		[this](const KeyValue& kv1, const KeyValue& kv2) {return compareKeyValue(kv1, kv2); });
@@ -301,10 +1609,24 @@ void Index::invalidateDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValu
 		}
 		int cmp = comparePackData(it1->key, it2->key);
 		if (cmp == 0) {
-			it1->value.rid = INVALID_RID;
-			it2->value.rid = INVALID_RID;
-			it1++;
-			it2++;
+			// in a unique index, a key may come with different rids, e.g., a removal of the old rid and an
+			// insertion of the new one by upsert(); only the same rid cancels out
+			auto end1 = it1;
+			while (end1 != kvs1.end() && (isInvalid(*end1) || comparePackData(end1->key, it1->key) == 0))
+				end1++;
+			auto end2 = it2;
+			while (end2 != kvs2.end() && (isInvalid(*end2) || comparePackData(end2->key, it2->key) == 0))
+				end2++;
+			for (auto kv1 = it1; kv1 != end1; kv1++) {
+				for (auto kv2 = it2; kv2 != end2 && !isInvalid(*kv1); kv2++) {
+					if (isInvalid(*kv2) || kv1->value.rid != kv2->value.rid)
+						continue;
+					kv1->value.rid = INVALID_RID;
+					kv2->value.rid = INVALID_RID;
+				}
+			}
+			it1 = end1;
+			it2 = end2;
 		}
 		else if (cmp < 0)
 			it1++;
@@ -325,12 +1647,13 @@ void Index::pushRemove(Node* curr)
 void Index::push(Node* curr, bool forInsert)
 {
 	// pushdown kvsToInsert / kvsToRemove in the correct children
+	fix(curr, true);
 	sortKvs(curr);
-	std::vector<KeyValue>& kvsToPush = forInsert ? curr->kvsToInsert : curr->kvsToRemove;
+	KeyValues& kvsToPush = forInsert ? curr->kvsToInsert : curr->kvsToRemove;
 	auto itToPush = kvsToPush.begin();
 	auto it = curr->kvs.begin();
 
-	std::vector<KeyValue> pulledUp;
+	Result pulledUp;
 
 	while (it != curr->kvs.end()) {
 		if (isInvalid(*it)) {
@@ -351,28 +1674,112 @@ void Index::push(Node* curr, bool forInsert)
 			pd.push_back(std::move(*itToPush));
 			itToPush++;
 		}
+		// a child is done with once its pending kvs are pushed, so it may be paged out again
+		int mark = (int)pinnedNodes.size();
 		auto res = forInsert ?
 			insert(it->value.child, std::move(pd)) :
 			remove(it->value.child, std::move(pd));
+		unpinFrom(mark);
 		if (res.countMerged) {
 			if (res.countMerged > 1) {
 				res.countMerged = res.countMerged;
 			}
 			curr->numKvs -= res.countMerged;
 		}
-		if (res.kvToInsert.has_value())
-			pulledUp.push_back(std::move(res.kvToInsert.value()));
+		for (auto [from, to] : { std::pair{ &res.kvsToInsert, &pulledUp.kvsToInsert },
+				std::pair{ &res.kvsLeftToInsert, &pulledUp.kvsLeftToInsert },
+				std::pair{ &res.kvsLeftToRemove, &pulledUp.kvsLeftToRemove } })
+			to->insert(to->end(), std::make_move_iterator(from->begin()), std::make_move_iterator(from->end()));
 		it++;
 	}
 	assert(itToPush == kvsToPush.end()); // since the last key is always null, greater than anything else
 	kvsToPush.clear();
+	settle(curr);
+	rebuildFilter(curr);
+	absorb(curr, std::move(pulledUp));
+}
+
+void Index::absorb(Node* curr, Result&& res)
+{
+	// merges and redistributions below may have rewritten keys of kvs through parentIt
+	updatePrefixes(curr);
+
+	// kvs left by a child are counted in curr already, and go down again with its next push
+	for (auto& kv : res.kvsLeftToInsert)
+		addToFilter(curr, kv);
+	for (auto& kv : res.kvsLeftToRemove)
+		addToFilter(curr, kv);
+	curr->kvsToInsert.insert(curr->kvsToInsert.end(),
+		std::make_move_iterator(res.kvsLeftToInsert.begin()),
+		std::make_move_iterator(res.kvsLeftToInsert.end()));
+	curr->kvsToRemove.insert(curr->kvsToRemove.end(),
+		std::make_move_iterator(res.kvsLeftToRemove.begin()),
+		std::make_move_iterator(res.kvsLeftToRemove.end()));
+
+	auto& pulledUp = res.kvsToInsert;
 
 	curr->numKvs += (int)pulledUp.size();
 	curr->kvsUnsorted.insert(curr->kvsUnsorted.end(),
 		std::make_move_iterator(pulledUp.begin()),
 		std::make_move_iterator(pulledUp.end()));
 	for (auto it = curr->kvsUnsorted.end() - pulledUp.size(); it != curr->kvsUnsorted.end(); it++)
-		it->value.child->parentIt = it;
+		linkChild(curr, it);
+}
+
+void Index::markOverdue(Node* curr)
+{
+	curr->isOverdue = true;
+	// pieces of a split have no parent until their parent takes them
+	for (auto node = curr; node != root && node->parent != nullptr; node = node->parent)
+		node->parent->hasOverdueBelow = true;
+}
+
+Index::Result Index::payOverdue(Node* curr)
+{
+	fix(curr, true);
+	if (curr->isOverdue)
+		return maintain(curr);
+	curr->hasOverdueBelow = false;
+	if (curr->isLeaf)
+		return {};
+
+	// follow a child that is or has an overdue node below; the flags are hints and may be stale
+	Node* child = nullptr;
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted }) {
+		for (auto& kv : *kvs) {
+			if (isInvalid(kv))
+				continue;
+			if (kv.value.child->isOverdue || kv.value.child->hasOverdueBelow) {
+				child = kv.value.child;
+				break;
+			}
+		}
+		if (child != nullptr)
+			break;
+	}
+	if (child == nullptr)
+		return {};
+
+	int mark = (int)pinnedNodes.size();
+	auto res = payOverdue(child);
+	unpinFrom(mark);
+	curr->numKvs -= res.countMerged;
+	absorb(curr, std::move(res));
+
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+		for (auto& kv : *kvs)
+			if (!isInvalid(kv) && (kv.value.child->isOverdue || kv.value.child->hasOverdueBelow))
+				curr->hasOverdueBelow = true;
+	if ((int)curr->kvs.size() > maxBranchingFactor || (int)curr->kvsUnsorted.size() > maxLazySize)
+		sortKvs(curr);
+	return rebalance(curr);
+}
+
+void Index::payOverdue()
+{
+	// every round pushes a node or clears a stale flag on the way
+	while (pushBudget > 0 && (root->isOverdue || root->hasOverdueBelow))
+		maintainRoot(payOverdue(root));
 }
 
 Index::Result Index::maintain(Node* curr)
@@ -382,19 +1789,45 @@ Index::Result Index::maintain(Node* curr)
 	//assert(curr == root || curr->prev == nullptr || curr->prev->parentIt->key.get() == nullptr
 	//	|| curr->numKvs >= (maxBranchingFactor + 1) / 2);
 	//assert(curr->numKvs <= maxBranchingFactor);
+	fix(curr, true);
 
-	if (curr->kvs.size() > maxBranchingFactor || curr->kvsUnsorted.size() > maxLazySize)
+	if ((int)curr->kvs.size() > maxBranchingFactor || (int)curr->kvsUnsorted.size() > maxLazySize)
 		sortKvs(curr);
 
-	if (curr->kvsToInsert.size() <= maxLazySize && curr->kvsToRemove.size() <= maxLazySize)
+	// with deferred maintenance, the root buffers grow up to a hard limit and maintainPending() pushes them
+	int lazySize = defersMaintenance && curr == root ? maxLazySize * DEFERRED_LAZY_FACTOR : maxLazySize;
+	// reads asked for the buffers of a hot node to be pushed whole
+	if (curr->isHot)
+		lazySize = 0;
+	if ((int)curr->kvsToInsert.size() <= lazySize && (int)curr->kvsToRemove.size() <= lazySize) {
+		curr->isOverdue = false;
+		curr->isHot = false;
+		return {};
+	}
+	// out of push budget: carry the push forward to later operations, up to the hard limit
+	int hardLimit = maxLazySize * DEFERRED_LAZY_FACTOR;
+	if (pushBudget == 0 && (int)curr->kvsToInsert.size() <= hardLimit && (int)curr->kvsToRemove.size() <= hardLimit) {
+		markOverdue(curr);
 		return {};
+	}
+	if (pushBudget > 0)
+		pushBudget--;
+	curr->isOverdue = false;
+	curr->isHot = false;
 
 	removeDuplicate(curr->kvsToInsert, curr->kvsToRemove);
+	// kvs cancelled out may leave buffers that fit their reservations again, and no push to settle them
+	settle(curr);
 
 	if (!curr->isLeaf) {
-		if (curr->kvsToInsert.size() > maxLazySize)
+		// in a unique index, a removal buffered with an insertion of its key by another rid, as by upsert(), goes
+		// down first; the leaf would hold the key twice otherwise, which a split could cut apart
+		if (!allowsDuplicate && (int)curr->kvsToInsert.size() > lazySize && !curr->kvsToRemove.empty())
+			pushRemove(curr);
+		// those removals may have emptied every child, and then the insertions go up again with curr
+		if (curr->numKvs > 0 && (int)curr->kvsToInsert.size() > lazySize)
 			pushInsert(curr);
-		if (curr->kvsToRemove.size() > maxLazySize)
+		if ((int)curr->kvsToRemove.size() > lazySize)
 			pushRemove(curr);
 	}
 	else {
@@ -421,18 +1854,30 @@ Index::Result Index::maintain(Node* curr)
 			if(isInvalid(kv))
 				curr->numKvs++;
 		invalidateDuplicate(curr->kvs, curr->kvsToRemove);
+		// a removal finds its kv unless the leaf lost it with a page that could not be read
 		for (auto& kv : curr->kvsToRemove)
-			assert(isInvalid(kv));
+			if (!isInvalid(kv)) {
+				assert(hasStorageFailed());
+				curr->numKvs++;
+			}
 		sortKvs(curr);
 		curr->kvsToRemove.clear();
+		settle(curr);
 	}
 
-	if (curr->kvs.size() > maxBranchingFactor || curr->kvsUnsorted.size() > maxLazySize)
+	if ((int)curr->kvs.size() > maxBranchingFactor || (int)curr->kvsUnsorted.size() > maxLazySize)
 		sortKvs(curr);
 
+	return rebalance(curr);
+}
+
+Index::Result Index::rebalance(Node* curr)
+{
 	if (curr != root && curr->numKvs < (maxBranchingFactor + 1) / 2) {
 		// regard the first kv as special and allow small numKvs
 		// -- this doesn't affect much overall with large enough branching factor
+		if (curr->prev != nullptr)
+			fix(curr->prev->parent);
 		if (curr->prev == nullptr || curr->prev->parentIt->key.get() == nullptr) {
 			if (curr->numKvs > 0)
 				return {};
@@ -444,27 +1889,35 @@ Index::Result Index::maintain(Node* curr)
 			auto next = curr->next;
 			if (prev != nullptr)
 				prev->next = next;
-			if (next != nullptr) {
+			if (next != nullptr)
 				next->prev = prev;
-				if (curr->parentIt->key.get() == nullptr) {
-					// curr is the only child of its parent
-					assert(curr->kvsToInsert.empty() && curr->kvsToRemove.empty());
-				}
-				else {
-					next->kvsToInsert.insert(next->kvsToInsert.end(),
-						std::make_move_iterator(curr->kvsToInsert.begin()),
-						std::make_move_iterator(curr->kvsToInsert.end()));
-					next->kvsToRemove.insert(next->kvsToRemove.end(),
-						std::make_move_iterator(curr->kvsToRemove.begin()),
-						std::make_move_iterator(curr->kvsToRemove.end()));
-				}
+			Result res{ .countMerged = 1 };
+			if (curr->parentIt->key.get() == nullptr) {
+				// curr is the only child of its parent, which buffers what curr still buffers
+				// -- an internal node holds back up to the lazy size of kvs while a push of removals empties it
+				res.kvsLeftToInsert.assign(std::make_move_iterator(curr->kvsToInsert.begin()),
+					std::make_move_iterator(curr->kvsToInsert.end()));
+				res.kvsLeftToRemove.assign(std::make_move_iterator(curr->kvsToRemove.begin()),
+					std::make_move_iterator(curr->kvsToRemove.end()));
+			}
+			else {
+				fix(next, true);
+				next->count += curr->count;
+				next->kvsToInsert.insert(next->kvsToInsert.end(),
+					std::make_move_iterator(curr->kvsToInsert.begin()),
+					std::make_move_iterator(curr->kvsToInsert.end()));
+				next->kvsToRemove.insert(next->kvsToRemove.end(),
+					std::make_move_iterator(curr->kvsToRemove.begin()),
+					std::make_move_iterator(curr->kvsToRemove.end()));
+				rebuildFilter(next);
 			}
 			curr->parentIt->value.child = INVALID_NODE;
-			delete curr;
-			return Result{ .countMerged = 1 };
+			deleteNode(curr);
+			return res;
 		}
 
 		auto prev = curr->prev;
+		fix(prev, true);
 		sortKvs(curr);
 		sortKvs(prev);
 
@@ -475,7 +1928,9 @@ Index::Result Index::maintain(Node* curr)
 			prev->next = curr->next;
 			if (curr->next != nullptr)
 				curr->next->prev = prev;
-			if (!prev->isLeaf) {
+			// the null key of the last child of prev takes the separator only if children of curr follow it
+			// -- a batch may drain every child of curr, and the last child of prev then covers curr's range too
+			if (!prev->isLeaf && k > 0) {
 				assert(!isInvalid(*prev->parentIt));
 				prev->kvs.back().key = prev->parentIt->key;
 			}
@@ -484,7 +1939,7 @@ Index::Result Index::maintain(Node* curr)
 				std::make_move_iterator(curr->kvs.end()));
 			if (!prev->isLeaf) {
 				for (auto it = prev->kvs.end() - k; it != prev->kvs.end(); it++)
-					it->value.child->parentIt = it;
+					linkChild(prev, it);
 			}
 			assert(curr->kvsUnsorted.empty());
 			prev->kvsToInsert.insert(prev->kvsToInsert.end(),
@@ -493,13 +1948,16 @@ Index::Result Index::maintain(Node* curr)
 			prev->kvsToRemove.insert(prev->kvsToRemove.end(),
 				std::make_move_iterator(curr->kvsToRemove.begin()),
 				std::make_move_iterator(curr->kvsToRemove.end()));
-			if (curr->parentIt->key.get() == nullptr)
-				prev->parentIt->key.reset();
-			else
-				prev->parentIt->key = curr->parentIt->key;
-			curr->parentIt->value.child = INVALID_NODE;
+			// prev takes over the entry of curr, whose key bounds them both; the entry of prev may sit in
+			// kvsUnsorted, where the null key of the last child must not go
+			prev->parentIt->value.child = INVALID_NODE;
+			curr->parentIt->value.child = prev;
+			linkChild(curr->parent, curr->parentIt);
 			prev->numKvs += k;
-			delete curr;
+			prev->count += curr->count;
+			updatePrefixes(prev);
+			rebuildFilter(prev);
+			deleteNode(curr);
 
 			auto res = maintain(prev);
 			if (res.countMerged) {
@@ -524,11 +1982,12 @@ Index::Result Index::maintain(Node* curr)
 				std::make_move_iterator(prev->kvs.end()));
 			if (!curr->isLeaf) {
 				for (auto it = curr->kvsUnsorted.end() - k; it != curr->kvsUnsorted.end(); it++)
-					it->value.child->parentIt = it;
+					linkChild(curr, it);
 			}
 			prev->kvs.erase(prev->kvs.end() - k, prev->kvs.end());
 			if(!prev->isLeaf)
 				prev->kvs.back().key.reset();
+			updatePrefixes(prev);
 			assert(prev->kvsUnsorted.empty());
 			for (auto& kv : prev->kvsToInsert) {
 				if (compareKeyValue(kv, *prev->parentIt))
@@ -554,113 +2013,172 @@ Index::Result Index::maintain(Node* curr)
 					kv.value.rid = INVALID_RID;
 				}
 			}
+			recount(prev);
+			recount(curr);
+			rebuildFilter(prev);
+			rebuildFilter(curr);
 			return {};
 		}
 	}
 
-	if (curr->numKvs > maxBranchingFactor) {
-		sortKvs(curr);
-		
-		// TODO: change here to support mass-insertion
-		// m = ceil(numKvs / maxBranchingFactor)
-		// split numKvs / m elements from curr per loop
-
-		// split
-		assert(curr->numKvs < maxBranchingFactor * 2);
-		int k = curr->numKvs / 2;
-		auto prev = new Node(curr->isLeaf, maxBranchingFactor, maxLazySize);
-		prev->prev = curr->prev;
-		if (curr->prev != nullptr)
-			curr->prev->next = prev;
-		curr->prev = prev;
-		prev->next = curr;
-		prev->kvs.insert(prev->kvs.end(),
-			std::make_move_iterator(curr->kvs.begin()),
-			std::make_move_iterator(curr->kvs.begin() + k));
+	if (curr->numKvs > maxBranchingFactor)
+		return split(curr);
+
+	return {};
+}
+
+Index::Result Index::split(Node* curr)
+{
+	// split curr into m = ceil(numKvs / maxBranchingFactor) nodes of nearly equal sizes in one pass
+	// -- the first m - 1 pieces go to new nodes placed before curr, and the last piece stays in curr
+	Result res;
+	int n = curr->numKvs;
+	int m = (n + maxBranchingFactor - 1) / maxBranchingFactor;
+	if (m <= 1)
+		return res;
+	fix(curr, true);
+	sortKvs(curr);
+
+	std::vector<Node*> pieces;
+	int from = 0;
+	for (int i = 0; i < m - 1; i++) {
+		int to = from + n / m + (i < n % m ? 1 : 0);
+		auto node = newNode(curr->isLeaf);
+		node->kvs.insert(node->kvs.end(),
+			std::make_move_iterator(curr->kvs.begin() + from),
+			std::make_move_iterator(curr->kvs.begin() + to));
+		node->numKvs = (int)node->kvs.size();
+		// conservatively, so that overdue kvs handed to the piece or nodes below it are found again
+		node->isOverdue = curr->isOverdue;
+		node->hasOverdueBelow = curr->hasOverdueBelow;
+
+		PackedData key;
 		if (!curr->isLeaf) {
-			// erase the k-th kv and pull it up
-			auto key = std::move(curr->kvs[k].key);
-			prev->kvs.emplace_back(curr->kvs[k].value.child);
-			curr->kvs.erase(curr->kvs.begin(), curr->kvs.begin() + k + 1);
-			for (auto it = prev->kvs.begin(); it != prev->kvs.end(); it++)
-				it->value.child->parentIt = it;
-			for (auto it = curr->kvs.begin(); it != curr->kvs.end(); it++)
-				it->value.child->parentIt = it;
-			prev->numKvs = (int)prev->kvs.size();
-			curr->numKvs = (int)curr->kvs.size();
-			auto res = KeyValue(std::move(key), prev);
-			for (auto& kv : curr->kvsToInsert) {
-				if (compareKeyValue(kv, res)) {
-					prev->kvsToInsert.emplace_back(std::move(kv.key), kv.value.child);
-					kv.value.child = nullptr;
-				}
-			}
-			for (auto& kv : curr->kvsToRemove) {
-				if (compareKeyValue(kv, res)) {
-					prev->kvsToRemove.emplace_back(std::move(kv.key), kv.value.child);
-					kv.value.child = nullptr;
-				}
-			}
-			return Result{ .kvToInsert = std::move(res) };
+			// pull up the key of the last kv, which becomes the null key of the piece
+			key = std::move(node->kvs.back().key);
+			node->kvs.back().key.reset();
+			for (auto it = node->kvs.begin(); it != node->kvs.end(); it++)
+				linkChild(node, it);
 		}
 		else {
-			// copy the k-th kv and pull it up
-			int n = curr->numKvs;
-			curr->kvs.erase(curr->kvs.begin(), curr->kvs.begin() + k);
-			prev->numKvs = (int)prev->kvs.size();
-			curr->numKvs = (int)curr->kvs.size();
-			auto res = KeyValue(curr->kvs.front().key, prev);
-			for (auto& kv : curr->kvsToInsert) {
-				if (compareKeyValue(kv, res)) {
-					prev->kvsToInsert.emplace_back(std::move(kv.key), kv.value.rid);
-					kv.value.rid = -1;
-				}
-			}
-			for (auto& kv : curr->kvsToRemove) {
-				if (compareKeyValue(kv, res)) {
-					prev->kvsToRemove.emplace_back(std::move(kv.key), kv.value.rid);
-					kv.value.rid = -1;
-				}
-			}
-			return Result{ .kvToInsert = std::move(res) };
+			// copy the first key of the next piece and pull it up
+			key = curr->kvs[to].key;
 		}
+		updatePrefixes(node);
+		res.kvsToInsert.emplace_back(std::move(key), node);
+		pieces.push_back(node);
+		from = to;
+	}
+	curr->kvs.erase(curr->kvs.begin(), curr->kvs.begin() + from);
+	curr->numKvs = (int)curr->kvs.size();
+	if (!curr->isLeaf) {
+		for (auto it = curr->kvs.begin(); it != curr->kvs.end(); it++)
+			linkChild(curr, it);
+	}
+	updatePrefixes(curr);
+
+	pieces.front()->prev = curr->prev;
+	if (curr->prev != nullptr)
+		curr->prev->next = pieces.front();
+	for (int i = 0; i + 1 < (int)pieces.size(); i++) {
+		pieces[i]->next = pieces[i + 1];
+		pieces[i + 1]->prev = pieces[i];
 	}
+	pieces.back()->next = curr;
+	curr->prev = pieces.back();
 
-	return {};
+	// hand pending kvs to the pieces covering them
+	// -- pending kvs always carry rids, even in internal nodes
+	auto cmp = std::bind(&Index::compareKeyValue, this, std::placeholders::_1, std::placeholders::_2);
+	auto distribute = [&](KeyValues& kvs, KeyValues Node::* pendingKvs) {
+		for (auto& kv : kvs) {
+			if (isInvalid(kv))
+				continue;
+			auto it = std::upper_bound(res.kvsToInsert.begin(), res.kvsToInsert.end(), kv, cmp);
+			if (it == res.kvsToInsert.end())
+				continue;
+			(it->value.child->*pendingKvs).emplace_back(std::move(kv.key), kv.value.rid);
+			kv.value.rid = INVALID_RID;
+		}
+	};
+	distribute(curr->kvsToInsert, &Node::kvsToInsert);
+	distribute(curr->kvsToRemove, &Node::kvsToRemove);
+	for (auto node : pieces) {
+		recount(node);
+		rebuildFilter(node);
+	}
+	recount(curr);
+	rebuildFilter(curr);
+	settle(curr);
+	return res;
 }
 
 void Index::maintainRoot(Result&& res) {
+	fix(root, true);
 	if (res.countMerged) {
 		if (res.countMerged > 1) {
 			res.countMerged = res.countMerged;
 		}
 		root->numKvs -= res.countMerged;
 	}
-	if (res.kvToInsert.has_value()) {
-		auto node = new Node(false, maxBranchingFactor, maxLazySize);
-		node->kvs.push_back(std::move(res.kvToInsert.value()));
+	while (!res.kvsToInsert.empty()) {
+		// grow by one level; with many pulled-up kvs, the new root may have to split again
+		auto node = newNode(false);
+		node->kvs.insert(node->kvs.end(),
+			std::make_move_iterator(res.kvsToInsert.begin()),
+			std::make_move_iterator(res.kvsToInsert.end()));
 		node->kvs.emplace_back(root);
-		node->kvs.front().value.child->parentIt = node->kvs.begin();
-		node->kvs.back().value.child->parentIt = node->kvs.begin() + 1;
-		node->numKvs = 2;
+		for (auto it = node->kvs.begin(); it != node->kvs.end(); it++)
+			linkChild(node, it);
+		node->numKvs = (int)node->kvs.size();
+		node->hasOverdueBelow = maxPushesPerOperation > 0;
+		updatePrefixes(node);
+		recount(node);
+		rebuildFilter(node);
 		root = node;
+		res = split(root);
 	}
 	while(root->numKvs == 1 && !root->isLeaf) {
+		fix(root, true);
 		removeDuplicate(root->kvsToInsert, root->kvsToRemove);
-		pushInsert(root);
-		pushRemove(root);
+		// a unique index pushes removals first, as maintain() does
+		if (!allowsDuplicate) {
+			pushRemove(root);
+			if (root->numKvs > 0)
+				pushInsert(root);
+		}
+		else {
+			pushInsert(root);
+			pushRemove(root);
+		}
 		sortKvs(root);
 		if (root->numKvs == 1) {
 			auto node = root->kvs.front().value.child;
-			delete root;
+			deleteNode(root);
 			root = node;
 		}
 	}
+	if (root->numKvs == 0 && !root->isLeaf) {
+		// a batch may empty every child of the root in one push, which leaves no child to collapse into
+		// -- start over from an empty leaf, which takes what the root still buffers
+		auto node = newNode(true);
+		node->kvsToInsert.insert(node->kvsToInsert.end(),
+			std::make_move_iterator(root->kvsToInsert.begin()),
+			std::make_move_iterator(root->kvsToInsert.end()));
+		node->kvsToRemove.insert(node->kvsToRemove.end(),
+			std::make_move_iterator(root->kvsToRemove.begin()),
+			std::make_move_iterator(root->kvsToRemove.end()));
+		node->count = root->count;
+		rebuildFilter(node);
+		deleteNode(root);
+		root = node;
+	}
 }
 
 PackedData Index::findSmallestKey(Node* curr) {
 	assert(curr != nullptr);
-	assert(curr->numKvs > 0);
+	assert(curr->numKvs > 0 || curr->isLeaf);
+	fix(curr);
 	PackedData* smallestKey = nullptr;
 	Node* leftmost = nullptr;
 	for (auto& kv : curr->kvs) {
@@ -678,32 +2196,61 @@ PackedData Index::findSmallestKey(Node* curr) {
 			leftmost = kv.value.child;
 		}
 	}
+	// a leaf may hold nothing but pending kvs, or nothing at all
 	for (auto& kv : curr->kvsToInsert) {
 		if (isInvalid(kv))
 			continue;
-		if (comparePackData(kv.key, *smallestKey) < 0)
+		if (smallestKey == nullptr || comparePackData(kv.key, *smallestKey) < 0)
 			smallestKey = &kv.key;
 	}
 	for (auto& kv : curr->kvsToRemove) {
 		if (isInvalid(kv))
 			continue;
-		if (comparePackData(kv.key, *smallestKey) < 0)
+		if (smallestKey == nullptr || comparePackData(kv.key, *smallestKey) < 0)
 			smallestKey = &kv.key;
 	}
-	assert(smallestKey != nullptr);
 	if (curr->isLeaf)
-		return PackedData(*smallestKey);
+		return smallestKey == nullptr ? PackedData() : PackedData(*smallestKey);
+	assert(smallestKey != nullptr);
 	auto res = findSmallestKey(leftmost);
-	if (comparePackData(*smallestKey, res) < 0)
+	if (res.get() == nullptr || comparePackData(*smallestKey, res) < 0)
 		return PackedData(*smallestKey);
 	else
 		return res;
 }
 
-std::vector<Index::KeyValue>::iterator Index::lowerBound(Node* curr, const PackedData& key, int hintPos)
+std::pair<int, int> Index::narrowByPrefix(Node* curr, const PackedData& key, int hintPos)
 {
+	int n = (int)curr->kvs.size();
+	if (!hasKeyPrefix() || hintPos >= n)
+		return { hintPos, n };
+	assert(curr->prefixes.size() == curr->kvs.size());
+	// prefixes are sorted: halve the range until a window is left, and count over it
+	// -- a middle that ties with key has the two bounds on either side, which are searched apart
+	const Int64* prefixes = curr->prefixes.data();
+	Int64 prefix = computePrefix(key);
 	int lo = hintPos;
-	int hi = curr->kvs.size();
+	int hi = n;
+	while (hi - lo > PREFIX_WINDOW) {
+		int mid = lo + (hi - lo) / 2;
+		if (prefixes[mid] < prefix)
+			lo = mid + 1;
+		else if (prefixes[mid] > prefix)
+			hi = mid;
+		else
+			return { searchSorted(prefixes, lo, mid, prefix, false), searchSorted(prefixes, mid + 1, hi, prefix, true) };
+	}
+	int numLess, numGreater;
+	countLessGreater(prefixes + lo, hi - lo, prefix, numLess, numGreater);
+	return { lo + numLess, hi - numGreater };
+}
+
+Index::KeyValues::iterator Index::lowerBound(Node* curr, const PackedData& key, int hintPos)
+{
+	// only kvs tying with key on the prefix need full comparisons
+	auto [from, to] = narrowByPrefix(curr, key, hintPos);
+	int lo = from;
+	int hi = to;
 	for (int i = lo; i < hi; i++) {
 		if (isInvalid(curr->kvs[i]))
 			continue;
@@ -730,13 +2277,20 @@ std::vector<Index::KeyValue>::iterator Index::lowerBound(Node* curr, const Packe
 		else
 			lo = j;
 	}
+	// kvs from to on are > key, so the first valid one of them is the answer
+	if (hi == to) {
+		while (hi < (int)curr->kvs.size() && isInvalid(curr->kvs[hi]))
+			hi++;
+	}
 	return curr->kvs.begin() + hi;
 }
 
-std::vector<Index::KeyValue>::iterator Index::upperBound(Node* curr, const PackedData& key, int hintPos)
+Index::KeyValues::iterator Index::upperBound(Node* curr, const PackedData& key, int hintPos)
 {
-	int lo = hintPos;
-	int hi = curr->kvs.size();
+	// only kvs tying with key on the prefix need full comparisons
+	auto [from, to] = narrowByPrefix(curr, key, hintPos);
+	int lo = from;
+	int hi = to;
 	for (int i = lo; i < hi; i++) {
 		if (isInvalid(curr->kvs[i]))
 			continue;
@@ -763,24 +2317,314 @@ std::vector<Index::KeyValue>::iterator Index::upperBound(Node* curr, const Packe
 		else
 			lo = j;
 	}
+	// kvs from to on are > key, so the first valid one of them is the answer
+	if (hi == to) {
+		while (hi < (int)curr->kvs.size() && isInvalid(curr->kvs[hi]))
+			hi++;
+	}
 	return curr->kvs.begin() + hi;
 }
 
-void Index::clean(Node* curr)
+void Index::build(std::vector<KeyValue>&& kvs, double fillFactor)
+{
+	Operation operation(this);
+	clean();
+	if (kvs.empty()) {
+		root = newNode(true);
+		return;
+	}
+
+	fillFactor = std::clamp(fillFactor, 0.5, 1.0);
+	int capacity = std::max(2, (int)(fillFactor * maxBranchingFactor));
+
+	// cut n kvs into ceil(n / capacity) nodes of nearly equal sizes
+	// -- each node is finished right away, so that only a few nodes are pinned at a time with storage
+	auto makeLevel = [&](std::vector<KeyValue>&& kvs, bool isLeaf, std::vector<Node*>& nodes, auto&& finish) {
+		int n = (int)kvs.size();
+		int m = (n + capacity - 1) / capacity;
+		int from = 0;
+		for (int i = 0; i < m; i++) {
+			int to = from + n / m + (i < n % m ? 1 : 0);
+			int mark = (int)pinnedNodes.size();
+			auto node = newNode(isLeaf);
+			node->kvs.insert(node->kvs.end(),
+				std::make_move_iterator(kvs.begin() + from),
+				std::make_move_iterator(kvs.begin() + to));
+			node->numKvs = (int)node->kvs.size();
+			if (!nodes.empty()) {
+				nodes.back()->next = node;
+				node->prev = nodes.back();
+			}
+			nodes.push_back(node);
+			finish(node);
+			updatePrefixes(node);
+			recount(node);
+			rebuildFilter(node);
+			unpinFrom(mark);
+			from = to;
+		}
+	};
+
+	// the smallest key in the subtree of each node of the current level
+	std::vector<PackedData> smallestKeys;
+	std::vector<Node*> nodes;
+	makeLevel(std::move(kvs), true, nodes, [&](Node* node) {
+		smallestKeys.push_back(node->kvs.front().key);
+	});
+
+	while (nodes.size() > 1) {
+		// a child is keyed by the smallest key of the next child
+		std::vector<KeyValue> kvsUp;
+		kvsUp.reserve(nodes.size());
+		for (int i = 0; i + 1 < (int)nodes.size(); i++)
+			kvsUp.emplace_back(smallestKeys[i + 1], nodes[i]);
+		kvsUp.emplace_back(nodes.back());
+
+		std::vector<Node*> parents;
+		std::vector<PackedData> parentSmallestKeys;
+		int i = 0;
+		makeLevel(std::move(kvsUp), false, parents, [&](Node* parent) {
+			parentSmallestKeys.push_back(std::move(smallestKeys[i]));
+			i += parent->numKvs;
+			// the last child of each parent is keyed by the null key
+			parent->kvs.back().key.reset();
+			for (auto it = parent->kvs.begin(); it != parent->kvs.end(); it++)
+				linkChild(parent, it);
+		});
+		nodes = std::move(parents);
+		smallestKeys = std::move(parentSmallestKeys);
+	}
+	root = nodes.front();
+}
+
+Index::Node* Index::newNode(bool isLeaf)
+{
+	auto slot = static_cast<std::byte*>(nodePool.allocate());
+	if (bufferPool != nullptr) {
+		// a new node has no pages yet, so it starts dirty
+		makeRoom();
+		auto frame = bufferPool->admit(slot);
+		bufferPool->markDirty(frame);
+		auto node = new (slot) Node(isLeaf, maxBranchingFactor, reservedLazySize, bufferPool->data(frame), bufferPool->frameSize());
+		node->frame = frame;
+		pinnedNodes.push_back(node);
+		return node;
+	}
+	auto blockOffset = computeBlockOffset();
+	return new (slot) Node(isLeaf, maxBranchingFactor, reservedLazySize, slot + blockOffset, nodePool.slotSize() - blockOffset);
+}
+
+void Index::deleteNode(Node* node)
+{
+	if (bufferPool != nullptr) {
+		for (auto page : node->pages)
+			pageFile->free(page);
+		if (node->frame >= 0) {
+			// keep the positions of pinnedNodes, which mark the pins of enclosing calls
+			auto it = std::find(pinnedNodes.rbegin(), pinnedNodes.rend(), node);
+			if (it != pinnedNodes.rend())
+				*it = nullptr;
+			// the kvs live in the frame, which may be freed on release
+			node->detach();
+			bufferPool->release(node->frame);
+		}
+	}
+	node->~Node();
+	nodePool.deallocate(node);
+}
+
+void Index::clean()
+{
+	// walk the slabs instead of the tree, then free them all at once
+	nodePool.forEachAllocated([](void* slot) {
+		static_cast<Node*>(slot)->~Node();
+	});
+	nodePool.release();
+	if (bufferPool != nullptr) {
+		bufferPool->clear();
+		pageFile->clear();
+	}
+	pinnedNodes.clear();
+	root = nullptr;
+}
+
+int Index::numSpilledNodes()
+{
+	int res = 0;
+	nodePool.forEachAllocated([&res](void* slot) {
+		res += static_cast<Node*>(slot)->arena.numSpilled() > 0;
+	});
+	return res;
+}
+
+void Index::linkChild(Node* parent, KeyValues::iterator it)
+{
+	it->value.child->parent = parent;
+	it->value.child->parentIt = it;
+}
+
+void Index::fix(Node* curr, bool isDirty)
+{
+	if (bufferPool == nullptr)
+		return;
+	if (curr->frame < 0) {
+		makeRoom();
+		curr->frame = bufferPool->admit(curr);
+		curr->attach(bufferPool->data(curr->frame), bufferPool->frameSize(), maxBranchingFactor, reservedLazySize);
+		if (!readNode(curr)) {
+			// the subtree is lost; an empty leaf keeps the running operation within a valid tree
+			curr->isLeaf = true;
+			curr->numKvs = 0;
+			curr->count = 0;
+			curr->isOverdue = false;
+			curr->hasOverdueBelow = false;
+			rebuildFilter(curr);
+			bufferPool->markDirty(curr->frame);
+		}
+		pinnedNodes.push_back(curr);
+	}
+	else if (!bufferPool->isPinned(curr->frame)) {
+		bufferPool->pin(curr->frame);
+		pinnedNodes.push_back(curr);
+	}
+	if (isDirty)
+		bufferPool->markDirty(curr->frame);
+}
+
+void Index::unpinFrom(int mark)
+{
+	if (bufferPool == nullptr)
+		return;
+	for (int i = mark; i < (int)pinnedNodes.size(); i++)
+		if (pinnedNodes[i] != nullptr)
+			bufferPool->unpin(pinnedNodes[i]->frame);
+	pinnedNodes.resize(mark);
+	// once the page file has failed, every node stays in memory
+	while (bufferPool->isOverCapacity() && !hasStorageFailed()) {
+		auto victim = static_cast<Node*>(bufferPool->findVictim());
+		if (victim == nullptr || !evict(victim))
+			break;
+	}
+}
+
+bool Index::evict(Node* curr)
+{
+	assert(!bufferPool->isPinned(curr->frame));
+	if (bufferPool->isDirty(curr->frame) && !writeNode(curr))
+		return false;
+	// parentIt of the children dangles until curr is loaded again
+	curr->detach();
+	bufferPool->release(curr->frame);
+	curr->frame = -1;
+	return true;
+}
+
+void Index::makeRoom()
 {
-	if (curr == nullptr)
+	if (!bufferPool->isFull() || hasStorageFailed())
 		return;
+	// every frame may be pinned by a long operation; then the pool goes over capacity for a while
+	auto victim = static_cast<Node*>(bufferPool->findVictim());
+	if (victim != nullptr)
+		evict(victim);
+}
+
+bool Index::writeNode(Node* curr)
+{
+	std::vector<std::byte> image;
+	auto append = [&image](const void* ptr, size_t size) {
+		auto bytes = static_cast<const std::byte*>(ptr);
+		image.insert(image.end(), bytes, bytes + size);
+	};
+	// the size of the image, filled in below
+	Int32 imageSize = 0;
+	append(&imageSize, sizeof(imageSize));
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted, &curr->kvsToInsert, &curr->kvsToRemove }) {
+		Int32 count = (Int32)kvs->size();
+		append(&count, sizeof(count));
+		for (auto& kv : *kvs) {
+			// -1 for the null key
+			Int32 size = kv.key.get() == nullptr ? -1 : kv.key.size();
+			append(&size, sizeof(size));
+			if (size > 0)
+				append(kv.key.get(), size);
+			append(&kv.value, sizeof(kv.value));
+		}
+	}
+
+	imageSize = (Int32)image.size();
+	std::memcpy(image.data(), &imageSize, sizeof(imageSize));
+	int numPages = (int)(image.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	image.resize((size_t)numPages * BLOCK_SIZE);
+	while ((int)curr->pages.size() < numPages)
+		curr->pages.push_back(pageFile->allocate());
+	while ((int)curr->pages.size() > numPages) {
+		pageFile->free(curr->pages.back());
+		curr->pages.pop_back();
+	}
+	for (int i = 0; i < numPages; i++)
+		if (!pageFile->write(curr->pages[i], image.data() + (size_t)i * BLOCK_SIZE))
+			return false;
+	bufferPool->markClean(curr->frame);
+	return true;
+}
+
+bool Index::readNode(Node* curr)
+{
+	assert(!curr->pages.empty());
+	std::vector<std::byte> image(curr->pages.size() * BLOCK_SIZE);
+	for (int i = 0; i < (int)curr->pages.size(); i++)
+		if (!pageFile->read(curr->pages[i], image.data() + (size_t)i * BLOCK_SIZE))
+			return false;
+
+	const std::byte* ptr = image.data();
+	auto read = [&ptr](void* dest, size_t size) {
+		std::memcpy(dest, ptr, size);
+		ptr += size;
+	};
+	// a size that does not fit the pages of curr means they read back other than written, e.g., as the zeros of a
+	// file cut short and grown again
+	Int32 imageSize;
+	read(&imageSize, sizeof(imageSize));
+	if (imageSize <= (Int32)(curr->pages.size() - 1) * BLOCK_SIZE || imageSize > (Int32)image.size()) {
+		pageFile->markFailed();
+		return false;
+	}
+	for (auto kvs : { &curr->kvs, &curr->kvsUnsorted, &curr->kvsToInsert, &curr->kvsToRemove }) {
+		Int32 count;
+		read(&count, sizeof(count));
+		for (int i = 0; i < count; i++) {
+			Int32 size;
+			read(&size, sizeof(size));
+			PackedData key;
+			if (size >= 0) {
+				key = PackedData(size);
+				key.push(ptr, size);
+				ptr += size;
+			}
+			Value value;
+			read(&value, sizeof(value));
+			if (key.get() == nullptr)
+				kvs->emplace_back(value.child);
+			else
+				kvs->emplace_back(key, value.rid);
+		}
+	}
+
+	// the kvs moved, so the children have to find them again
 	if (!curr->isLeaf) {
-		for (auto& kv : curr->kvs)
-			clean(kv.value.child);
-		for (auto& kv : curr->kvsUnsorted)
-			clean(kv.value.child);
+		for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+			for (auto it = kvs->begin(); it != kvs->end(); it++)
+				if (!isInvalid(*it))
+					linkChild(curr, it);
 	}
-	delete curr;
+	updatePrefixes(curr);
+	return true;
 }
 
 void Index::dump(std::ostream& os)
 {
+	Operation operation(this);
 	os << "==========dump start==========\n";
 	dump(root, os);
 	os << "==========dump end==========\n\n";
@@ -788,6 +2632,7 @@ void Index::dump(std::ostream& os)
 
 void Index::dump(Node* curr, std::ostream& os)
 {
+	fix(curr);
 	os << curr << "\n";
 	os << "numKvs = " << curr->numKvs << "\n";
 	os << "kvs = ";
@@ -799,18 +2644,21 @@ void Index::dump(Node* curr, std::ostream& os)
 	os << "kvsToRemove = ";
 	dump(curr->kvsToRemove, true, os);
 	if (!curr->isLeaf) {
+		int mark = (int)pinnedNodes.size();
 		for (auto& kv : curr->kvs) {
 			if (kv.value.child != nullptr)
 				dump(kv.value.child, os);
+			unpinFrom(mark);
 		}
 		for (auto& kv : curr->kvsUnsorted) {
 			if (kv.value.child != nullptr)
 				dump(kv.value.child, os);
+			unpinFrom(mark);
 		}
 	}
 }
 
-void Index::dump(const std::vector<KeyValue>& kvs, bool printsRID, std::ostream& os)
+void Index::dump(const KeyValues& kvs, bool printsRID, std::ostream& os)
 {
 	os << "[";
 	for (auto& kv : kvs) {
@@ -819,14 +2667,14 @@ void Index::dump(const std::vector<KeyValue>& kvs, bool printsRID, std::ostream&
 			os << "null";
 		else {
 			os << "(";
-			std::byte* ptr = static_cast<std::byte*>(kv.key.get());
+			auto key = normalizesKey ? decodeKey(kv.key) : PackedData(kv.key);
+			const std::byte* ptr = static_cast<std::byte*>(key.get());
 			for (auto& t : types) {
 				switch (t) {
 				case DataType::INT32:
 				case DataType::DATE:
 					{
-						Int32* val = reinterpret_cast<Int32*>(ptr);
-						os << *val << " ";
+						os << PackedData::read<Int32>(ptr) << " ";
 						ptr += sizeof(Int32);
 						break;
 					}
@@ -834,16 +2682,13 @@ void Index::dump(const std::vector<KeyValue>& kvs, bool printsRID, std::ostream&
 				case DataType::DATETIME:
 				case DataType::HASHED_INT:
 					{
-						Int64* val = reinterpret_cast<Int64*>(ptr);
-						os << *val << " ";
+						os << PackedData::read<Int64>(ptr) << " ";
 						ptr += sizeof(Int64);
 						break;
 					}
 				case DataType::STRING:
 					{
-						String* val = reinterpret_cast<String*>(ptr);
-						os << *val << " ";
-						ptr += sizeof(String);
+						os << PackedData::readString(ptr) << " ";
 						break;
 					}
 				}
@@ -862,11 +2707,13 @@ void Index::dump(const std::vector<KeyValue>& kvs, bool printsRID, std::ostream&
 
 void Index::checkIntegrity()
 {
+	Operation operation(this);
 	checkIntegrity(root, PackedData(), false, PackedData());
 }
 
 void Index::checkIntegrity(Node* curr, const PackedData& lb, bool existsLB, const PackedData& ub)
 {
+	fix(curr);
 	bool existsPrev = false;
 	bool reachedLast = false;
 	PackedData prevKey;
@@ -888,13 +2735,23 @@ void Index::checkIntegrity(Node* curr, const PackedData& lb, bool existsLB, cons
 			continue;
 		sorted.push_back(KeyValue(kv.key, kv.value.child));
 	}
+	if (hasKeyPrefix()) {
+		assert(curr->prefixes.size() == curr->kvs.size());
+		for (int i = 0; i < (int)curr->kvs.size(); i++) {
+			assert(isInvalid(curr->kvs[i]) || curr->prefixes[i] == computePrefix(curr->kvs[i].key));
+			assert(i == 0 || curr->prefixes[i - 1] <= curr->prefixes[i]);
+		}
+	}
 	std::sort(sorted.begin(), sorted.end(), [this](const KeyValue& kv1, const KeyValue& kv2) {return compareKeyValue(kv1, kv2); });
 	for (auto& kv : sorted) {
 		assert(kv.key.get() == nullptr || isInvalid(kv) ||
 			(comparePackData(kv.key, ub) < 0 && (!existsLB || comparePackData(kv.key, lb) >= 0)));
 		assert(!reachedLast);
-		if(!curr->isLeaf && kv.value.child != nullptr)
+		if (!curr->isLeaf && kv.value.child != nullptr) {
+			int mark = (int)pinnedNodes.size();
 			checkIntegrity(kv.value.child, prevKey, existsPrev, kv.key);
+			unpinFrom(mark);
+		}
 		if (kv.key.get() == nullptr)
 			reachedLast = true;
 		else if (kv.value.child != nullptr) {
@@ -912,23 +2769,175 @@ void Index::checkIntegrity(Node* curr, const PackedData& lb, bool existsLB, cons
 		assert(kv.value.child == nullptr ||
 			(comparePackData(kv.key, ub) < 0 && (!existsLB || comparePackData(kv.key, lb) >= 0)));
 	}
+	assert(curr->count == computeCount(curr));
+	for (auto kvs : { &curr->kvsToInsert, &curr->kvsToRemove })
+		for (auto& kv : *kvs)
+			assert(isInvalid(kv) || mayContain(curr, hashUserKey(kv.key)));
+	if (curr->isLeaf) {
+		for (auto kvs : { &curr->kvs, &curr->kvsUnsorted })
+			for (auto& kv : *kvs)
+				assert(isInvalid(kv) || mayContain(curr, hashUserKey(kv.key)));
+	}
 }
 
 PackedData Index::makeInternalKey(const PackedData& key, Int64 rid)
 {
+	if (normalizesKey)
+		return encodeKey(allowsDuplicate ? PackedData::combine(key, rid) : key);
 	return allowsDuplicate ? PackedData::combine(key, rid) : key;
 }
 
-int Index::computeBranchingFactor(const std::vector<DataType>& types, int size)
+PackedData Index::makeUserKey(const PackedData& internalKey)
+{
+	auto key = normalizesKey ? decodeKey(internalKey) : PackedData(internalKey);
+	return allowsDuplicate ? PackedData::truncate(key, key.size() - sizeof(Int64)) : key;
+}
+
+PackedData Index::encodeKey(const PackedData& key)
+{
+	PackedData res(key.size());
+	auto pushBigEndian = [&res](std::uint64_t val, int size) {
+		std::byte bytes[sizeof(std::uint64_t)];
+		for (int i = size - 1; i >= 0; i--) {
+			bytes[i] = static_cast<std::byte>(val & 0xFF);
+			val >>= 8;
+		}
+		res.push(bytes, size);
+	};
+
+	const std::byte* ptr = static_cast<std::byte*>(key.get());
+	for (auto& t : types) {
+		switch (t) {
+		case DataType::INT32:
+		case DataType::DATE:
+			{
+				auto val = static_cast<std::uint32_t>(PackedData::read<Int32>(ptr));
+				pushBigEndian(val ^ (1u << 31), sizeof(Int32));
+				ptr += sizeof(Int32);
+				break;
+			}
+		case DataType::INT64:
+		case DataType::DATETIME:
+		case DataType::HASHED_INT:
+			{
+				auto val = static_cast<std::uint64_t>(PackedData::read<Int64>(ptr));
+				pushBigEndian(val ^ (1ull << 63), sizeof(Int64));
+				ptr += sizeof(Int64);
+				break;
+			}
+		case DataType::STRING:
+			{
+				const std::byte escaped[] = { std::byte{0x00}, std::byte{0xFF} };
+				const std::byte terminator[] = { std::byte{0x00}, std::byte{0x00} };
+				auto val = PackedData::readString(ptr);
+				for (auto ch : val) {
+					if (ch == '\0')
+						res.push(escaped, sizeof(escaped));
+					else {
+						auto b = static_cast<std::byte>(ch);
+						res.push(&b, 1);
+					}
+				}
+				res.push(terminator, sizeof(terminator));
+				break;
+			}
+		}
+	}
+	return res;
+}
+
+Int64 Index::computePrefix(const PackedData& key)
+{
+	if (key.get() == nullptr)
+		return std::numeric_limits<Int64>::max();
+	const std::byte* ptr = static_cast<std::byte*>(key.get());
+	if (normalizesKey) {
+		// zero padding keeps a short key <= any key it is a prefix of
+		std::uint64_t val = 0;
+		for (int i = 0; i < (int)sizeof(std::uint64_t); i++)
+			val = (val << 8) | (i < key.size() ? static_cast<std::uint64_t>(ptr[i]) : 0);
+		return static_cast<Int64>(val ^ (1ull << 63));
+	}
+	switch (types.front()) {
+	case DataType::INT32:
+	case DataType::DATE:
+		return PackedData::read<Int32>(ptr);
+	case DataType::INT64:
+	case DataType::DATETIME:
+	case DataType::HASHED_INT:
+		return PackedData::read<Int64>(ptr);
+	default:
+		assert(false);
+		return 0;
+	}
+}
+
+void Index::updatePrefixes(Node* curr)
+{
+	if (!hasKeyPrefix())
+		return;
+	// an invalidated kv may hold a stale key, so it repeats the prefix before it to keep prefixes sorted
+	Int64 prefix = std::numeric_limits<Int64>::min();
+	curr->prefixes.clear();
+	for (auto& kv : curr->kvs) {
+		if (!isInvalid(kv))
+			prefix = computePrefix(kv.key);
+		curr->prefixes.push_back(prefix);
+	}
+}
+
+PackedData Index::decodeKey(const PackedData& encodedKey)
+{
+	PackedData res(PackedData::computeSize(types));
+	auto popBigEndian = [](const std::byte*& ptr, int size) {
+		std::uint64_t val = 0;
+		for (int i = 0; i < size; i++)
+			val = (val << 8) | static_cast<std::uint64_t>(*ptr++);
+		return val;
+	};
+
+	const std::byte* ptr = static_cast<std::byte*>(encodedKey.get());
+	for (auto& t : types) {
+		switch (t) {
+		case DataType::INT32:
+		case DataType::DATE:
+			res.push(static_cast<Int32>(popBigEndian(ptr, sizeof(Int32)) ^ (1u << 31)));
+			break;
+		case DataType::INT64:
+		case DataType::DATETIME:
+		case DataType::HASHED_INT:
+			res.push(static_cast<Int64>(popBigEndian(ptr, sizeof(Int64)) ^ (1ull << 63)));
+			break;
+		case DataType::STRING:
+			{
+				String val;
+				while (!(ptr[0] == std::byte{0x00} && ptr[1] == std::byte{0x00})) {
+					if (ptr[0] == std::byte{0x00}) {
+						val.push_back('\0');
+						ptr += 2;
+					}
+					else
+						val.push_back(static_cast<char>(*ptr++));
+				}
+				ptr += 2;
+				res.push(std::move(val));
+				break;
+			}
+		}
+	}
+	return res;
+}
+
+int Index::computeBranchingFactor(int size)
 {
-	int keySize = PackedData::computeSize(types);
-	keySize += 3 - (keySize + 3) % 4;
+	// what a node holds at its nominal sizes counts against size: maxBranchingFactor kvs with their prefixes,
+	// and three lazy buffers
+	// -- a kv is a whole KeyValue whatever the schema, as a key up to PackedData's inline capacity lives in it;
+	// longer keys live on the heap
+	// -- the Node itself lives outside the block, and the block reserves room for overflow beyond these sizes
 	auto computeSize = [=](int k) {
-		int size = sizeof(Node);
-		size -= sizeof(std::vector<KeyValue>) * 3;
-		size -= sizeof(std::vector<KeyValue>::iterator);
-		size += (keySize + sizeof(Value)) * k;
-		size += (keySize + sizeof(Value)) * (int)sqrt(k) * 3;
+		int size = (int)(sizeof(KeyValue) + sizeof(Int64)) * k;
+		size += (int)sizeof(KeyValue) * (int)sqrt(k) * 3;
 		return size;
 	};
 	int lo = 2;
@@ -960,15 +2969,21 @@ int Index::comparePackData(const PackedData& data1, const PackedData& data2)
 	}
 	if (data2.get() == nullptr)
 		return -1;
-	std::byte* ptr1 = static_cast<std::byte*>(data1.get());
-	std::byte* ptr2 = static_cast<std::byte*>(data2.get());
+	if (normalizesKey) {
+		int cmp = std::memcmp(data1.get(), data2.get(), std::min(data1.size(), data2.size()));
+		if (cmp != 0)
+			return cmp < 0 ? -1 : 1;
+		return data1.size() < data2.size() ? -1 : (data1.size() > data2.size() ? 1 : 0);
+	}
+	const std::byte* ptr1 = static_cast<std::byte*>(data1.get());
+	const std::byte* ptr2 = static_cast<std::byte*>(data2.get());
 	for (auto& t : types) {
 		switch (t) {
 		case DataType::INT32:
 		case DataType::DATE:
 			{
-				Int32 val1 = *reinterpret_cast<Int32*>(ptr1);
-				Int32 val2 = *reinterpret_cast<Int32*>(ptr2);
+				Int32 val1 = PackedData::read<Int32>(ptr1);
+				Int32 val2 = PackedData::read<Int32>(ptr2);
 				if (val1 < val2)
 					return -1;
 				if (val1 > val2)
@@ -981,8 +2996,8 @@ int Index::comparePackData(const PackedData& data1, const PackedData& data2)
 		case DataType::DATETIME:
 		case DataType::HASHED_INT:
 			{
-				Int64 val1 = *reinterpret_cast<Int64*>(ptr1);
-				Int64 val2 = *reinterpret_cast<Int64*>(ptr2);
+				Int64 val1 = PackedData::read<Int64>(ptr1);
+				Int64 val2 = PackedData::read<Int64>(ptr2);
 				if (val1 < val2)
 					return -1;
 				if (val1 > val2)
@@ -993,14 +3008,11 @@ int Index::comparePackData(const PackedData& data1, const PackedData& data2)
 			}
 		case DataType::STRING:
 			{
-				int cmp = (*reinterpret_cast<String*>(ptr1))
-					.compare(*reinterpret_cast<String*>(ptr2));
+				int cmp = PackedData::readString(ptr1).compare(PackedData::readString(ptr2));
 				if (cmp < 0)
 					return -1;
 				if (cmp > 0)
 					return 1;
-				ptr1 += sizeof(String);
-				ptr2 += sizeof(String);
 				break;
 			}
 		}
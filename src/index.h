@@ -2,14 +2,26 @@
 
 #include "constants.h"
 #include "data.h"
+#include "slab_pool.h"
+#include "block_resource.h"
+#include "buffer_pool.h"
+#include "wal.h"
 
+#include <new>
 #include <list>
 #include <vector>
+#include <memory>
+#include <random>
 #include <optional>
 #include <iostream>
+#include <memory_resource>
 
 // assumption for branching factor: BLOCK_SIZE is big enough to accomodate a node with at least two keys and values
-// it is better to directly allocate BLOCK_SIZE for Node and allocate memory for KeyValue inside that memory space
+// a node with maxBranchingFactor kvs and full lazy buffers fits in BLOCK_SIZE, counted in whole KeyValues
+// each Node takes whole BLOCK_SIZE blocks at once, enough to overflow before a split or push, and its kvs and buffers
+// draw memory from that space
+// nodes and their blocks live in slots of a per-Index SlabPool
+// with storage, only the node itself lives there, and its block is a frame of a BufferPool that is paged out to a file
 
 // Value v{.child = INVALID_NODE};
 // -> v.rid == INVALID_RID
@@ -22,6 +34,12 @@ class Index {
 	};
 	static constexpr Node* INVALID_NODE = static_cast<Node*>(nullptr);
 	static constexpr Int64 INVALID_RID = reinterpret_cast<Int64>(nullptr);
+	static constexpr int NODES_PER_SLAB = 64;
+	static constexpr int DEFERRED_LAZY_FACTOR = 4;
+	// the adaptive lazy size is recomputed once this many reads and writes are seen
+	static constexpr int ADAPT_WINDOW = 4096;
+	// bits of the filter of a node per kv its block is laid out for
+	static constexpr int FILTER_BITS_PER_KEY = 8;
 
 	struct KeyValue {
 		PackedData key;
@@ -43,95 +61,522 @@ class Index {
 			key{key}, value{.child = child} {}
 	};
 
+	using KeyValues = std::pmr::vector<KeyValue>;
+
 	// for internal nodes, the last element of kvs contains null key, which is greater than any other key
 	struct Node {
-		std::vector<KeyValue> kvs;
-		std::vector<KeyValue> kvsUnsorted;
+		// the reserved capacities of all vectors below, laid out back to back in one block
+		// -- a vector outgrowing its reservation moves to free space of the block if it fits there, and to the heap
+		// otherwise; either way its old space is free again, and relayout() brings it back once it is small again
+		static size_t computeBlockSize(int maxBranchingFactor, int maxLazySize) {
+			size_t size = sizeof(KeyValue) * (maxBranchingFactor + maxLazySize * 8);
+			size += sizeof(Int64) * (maxBranchingFactor + maxLazySize * 2);
+			return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+		}
+		BlockResource arena;
+
+		KeyValues kvs;
+		// prefixes[i] is the key prefix of kvs[i], kept for the fast search in lowerBound/upperBound
+		std::pmr::vector<Int64> prefixes;
+		KeyValues kvsUnsorted;
 		int numKvs{ 0 };
 
-		std::vector<KeyValue> kvsToInsert;
-		std::vector<KeyValue> kvsToRemove;
+		KeyValues kvsToInsert;
+		KeyValues kvsToRemove;
 
-		std::vector<KeyValue>::iterator parentIt;
+		Node* parent{ nullptr };
+		KeyValues::iterator parentIt;
 		Node* prev{ nullptr };
 		Node* next{ nullptr };
 		bool isLeaf;
-		Node(bool isLeaf, int maxBranchingFactor, int maxLazySize) :
+		// with a push budget: the buffers are due for a push carried forward, or some node below is
+		bool isOverdue{ false };
+		bool hasOverdueBelow{ false };
+		// entries that selects since the last write scanned linearly or skipped as invalid
+		int readCost{ 0 };
+		// selects asked for the buffers to be pushed down
+		bool isHot{ false };
+		// live pairs in the subtree: kvs of the leaves plus the buffers of curr and below, but not those above
+		Int64 count{ 0 };
+		// with filters: a blocked Bloom filter over the user keys of the buffers, and of kvs and kvsUnsorted in a leaf
+		// -- a key sets bits of one word only, so that a probe reads one cache line; empty for no filter
+		// -- removals leave their bits until the next rebuild, which only makes the filter answer maybe more often
+		std::vector<std::uint64_t> filter;
+
+		// with storage: the frame holding the block while loaded, or -1 while paged out to pages
+		BufferPool::FrameId frame{ -1 };
+		std::vector<PageFile::PageId> pages;
+
+		Node(bool isLeaf, int maxBranchingFactor, int maxLazySize, std::byte* block, size_t blockSize) :
+			arena(block, blockSize),
+			kvs(&arena), prefixes(&arena), kvsUnsorted(&arena), kvsToInsert(&arena), kvsToRemove(&arena),
 			isLeaf(isLeaf) {
+			reserve(maxBranchingFactor, maxLazySize);
+		}
+		void reserve(int maxBranchingFactor, int maxLazySize) {
 			kvs.reserve(maxBranchingFactor + maxLazySize*2);
+			prefixes.reserve(maxBranchingFactor + maxLazySize*2);
 			kvsUnsorted.reserve(maxLazySize*2); // *2 to prevent reallocating when merge
 			kvsToInsert.reserve(maxLazySize*2);
 			kvsToRemove.reserve(maxLazySize*2);
 		}
+		// lay kvs and buffers out in the block again, once they fit their reservations after some outgrew them
+		// returns true if they moved
+		bool relayout(int maxBranchingFactor, int maxLazySize) {
+			if (arena.numSpilled() == 0 || (int)kvs.size() > maxBranchingFactor + maxLazySize*2 ||
+				(int)kvsUnsorted.size() > maxLazySize*2 || (int)kvsToInsert.size() > maxLazySize*2 ||
+				(int)kvsToRemove.size() > maxLazySize*2)
+				return false;
+			auto moveOut = [](KeyValues& kvs) {
+				return std::vector<KeyValue>(std::make_move_iterator(kvs.begin()), std::make_move_iterator(kvs.end()));
+			};
+			auto moveIn = [](std::vector<KeyValue>& from, KeyValues& to) {
+				to.insert(to.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+			};
+			auto tempKvs = moveOut(kvs);
+			std::vector<Int64> tempPrefixes(prefixes.begin(), prefixes.end());
+			auto tempKvsUnsorted = moveOut(kvsUnsorted);
+			auto tempKvsToInsert = moveOut(kvsToInsert);
+			auto tempKvsToRemove = moveOut(kvsToRemove);
+			auto block = arena.data();
+			auto blockSize = arena.size();
+			detach();
+			attach(block, blockSize, maxBranchingFactor, maxLazySize);
+			moveIn(tempKvs, kvs);
+			prefixes.assign(tempPrefixes.begin(), tempPrefixes.end());
+			moveIn(tempKvsUnsorted, kvsUnsorted);
+			moveIn(tempKvsToInsert, kvsToInsert);
+			moveIn(tempKvsToRemove, kvsToRemove);
+			return true;
+		}
+		// empty kvs and buffers and stop using the block
+		void detach() {
+			KeyValues(&arena).swap(kvs);
+			std::pmr::vector<Int64>(&arena).swap(prefixes);
+			KeyValues(&arena).swap(kvsUnsorted);
+			KeyValues(&arena).swap(kvsToInsert);
+			KeyValues(&arena).swap(kvsToRemove);
+			arena.release();
+		}
+		// draw kvs and buffers from another block after detach()
+		// -- the vectors keep pointing at arena, which is reset in place
+		void attach(std::byte* block, size_t blockSize, int maxBranchingFactor, int maxLazySize) {
+			arena.reset(block, blockSize);
+			reserve(maxBranchingFactor, maxLazySize);
+		}
 	};
 
 	struct Result {
 		int countMerged{0};
-		std::optional<Index::KeyValue> kvToInsert{};
+		// kvs pulled up by splits, in ascending order of keys
+		std::vector<Index::KeyValue> kvsToInsert{};
+		// pending kvs of an emptied child that was the only child of its parent, to be buffered there again
+		std::vector<Index::KeyValue> kvsLeftToInsert{};
+		std::vector<Index::KeyValue> kvsLeftToRemove{};
 	};
 
 public:
-	Index(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate); 
+	// iterates live (key, rid) pairs in key order, materializing one leaf at a time
+	// -- pending kvs of the ancestors are folded in as each leaf is loaded
+	// -- a cursor is invalidated by any modification of the index
+	class Cursor {
+	public:
+		// moves to the first pair whose key is >= key
+		void seek(const PackedData& key);
+		bool valid() const { return pos < (int)window.size(); }
+		void next();
+		PackedData key() const;
+		Int64 rid() const { return window[pos].second; }
+	private:
+		friend class Index;
+		Cursor(Index* index) : index(index) {}
+
+		Index* index;
+		// live pairs of the current leaf >= the sought key, with internal keys
+		std::vector<std::pair<PackedData, Int64>> window;
+		int pos{ 0 };
+		// exclusive upper bound of the current leaf; null key if it is the last leaf
+		PackedData ub;
+
+		const PackedData& internalKey() const { return window[pos].first; }
+		// fill window with the live pairs >= lo of the leaf covering lo, skipping empty leaves
+		void load(PackedData lo);
+	};
+
+	// normalizesKey: store internal keys as order-preserving byte strings so that comparison is a memcmp
+	// storagePath: if not empty, page nodes out to this file and keep at most numFrames of them in memory
+	// -- the file is scratch space of this Index and is removed with it
+	Index(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate,
+		bool normalizesKey = false, const std::string& storagePath = "", int numFrames = 1024);
 	Index(Index&& other) noexcept;
 	~Index();
 
+	// builds an index bottom-up from unsorted keys
+	// fillFactor: the portion of maxBranchingFactor filled in each node, in [0.5, 1]
+	// returns std::nullopt if a key of a unique index, or a pair (key, rid), is given twice
+	static std::optional<Index> bulkLoad(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate,
+		const std::vector<PackedData>& keys, const std::vector<Int64>& rids, double fillFactor = 1.0,
+		bool normalizesKey = false);
+	// restores an index from a checkpoint, building it bottom-up with fillFactor like bulkLoad()
+	// -- the schema comes from the checkpoint; storagePath and numFrames are as in the constructor
+	// returns std::nullopt if path is not a complete checkpoint of this version
+	static std::optional<Index> open(const std::string& path, double fillFactor = 1.0,
+		const std::string& storagePath = "", int numFrames = 1024);
+
 	// returns true if success
 	bool insert(const PackedData& key, Int64 rid, bool checksIntegrity=false);
-	bool insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegtrity = false);
+	bool insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity = false);
+	// what insertUnique() and upsert() did
+	struct UniqueResult {
+		enum class Status {
+			// (key, rid) is in, and committed to the log if one is attached
+			APPLIED,
+			// insertUnique() only: key has another rid already, and nothing changed
+			CONFLICT,
+			// the log or the storage has failed (see attachLog(), hasStorageFailed()): nothing changed if it had
+			// failed before the call; otherwise the change is applied in memory, as by insert(), but not committed,
+			// and there is no rollback -- the index stays failed and refuses later changes
+			FAILED,
+		};
+		Status status;
+		// the rid key had before the call, or std::nullopt if key was not there or the call was refused
+		std::optional<Int64> previousRid;
+	};
+	// unique index only: inserts (key, rid) unless key is there already, which is checked in the same descent
+	// that finds where key would be, using the buffers on its way
+	UniqueResult insertUnique(const PackedData& key, Int64 rid);
+	// unique index only: inserts (key, rid), replacing the rid key had, as insertUnique()
+	// -- the removal of the replaced rid and the insertion go down, and into the log, as one batch
+	UniqueResult upsert(const PackedData& key, Int64 rid);
 	// returns true if success
 	bool remove(const PackedData& key, Int64 rid, bool checksIntegrity=false);
-	bool remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegtrity = false);
+	bool remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity = false);
+	// applies a batch of insertions and removals at once
+	// returns true if success; with checksIntegrity, nothing is applied on failure
+	bool update(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+		const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove, bool checksIntegrity = false);
+	// update() split in two: prepare() encodes and sorts the batch without touching the tree,
+	// so that it can run outside a lock around the index, and apply() drops it in as update() does
+	// -- nothing is checked against the tree
+	class PreparedUpdate {
+		friend class Index;
+		KeyValues kvsToInsert;
+		KeyValues kvsToRemove;
+		// for the log
+		std::vector<PackedData> keysToInsert;
+		std::vector<Int64> ridsToInsert;
+		std::vector<PackedData> keysToRemove;
+		std::vector<Int64> ridsToRemove;
+	};
+	PreparedUpdate prepare(std::vector<PackedData>&& keysToInsert, std::vector<Int64>&& ridsToInsert,
+		std::vector<PackedData>&& keysToRemove, std::vector<Int64>&& ridsToRemove);
+	// returns false if the log has failed
+	bool apply(PreparedUpdate&& update);
+	// the selects change nothing, and may share the index, unless read compaction or the adaptive lazy size is
+	// turned on or the index has storage (see below)
 	// returns rids: equal search
 	std::vector<int> select(const PackedData& key);
-	// returns rids: range search
+	// returns rids: range search, in key order, and for pairs of one key in rid order
+	// -- unlike select(key), whose rids are in rid order only
 	std::vector<int> selectRange(const PackedData& loKey, const PackedData& hiKey);
 	// returns true if exists
 	bool select(const PackedData& key, Int64 rid);
+	// rids of many equal searches, flat: the rids of keys[i] are rids[offsets[i]] to rids[offsets[i + 1] - 1]
+	struct SelectManyResult {
+		std::vector<int> offsets;
+		std::vector<int> rids;
+	};
+	// returns rids: equal search for each of keys, as select(key) but in one traversal
+	// -- the keys are sorted once and go down the tree together a level at a time, so that a node on the way of
+	// many keys is searched and its buffers scanned once, and the nodes of the next level are prefetched
+	SelectManyResult selectMany(const std::vector<PackedData>& keys);
+	// returns a cursor; call seek() before use
+	Cursor cursor();
+	// returns the number of pairs with loKey <= key <= hiKey, from the subtree counts along two paths
+	// -- the two leaves at the ends of the paths are still read, as only they tell how many of their pairs are in
+	// range: a binary search, then a scan of their kvsUnsorted, and of their kvs only while removed kvs linger there
+	Int64 count(const PackedData& loKey, const PackedData& hiKey);
+	// returns the number of pairs with a key < key, i.e., the position of the first pair >= key; one path, as count()
+	Int64 rank(const PackedData& key);
+	// returns the k-th pair (key, rid) in key order, counting from 0, or std::nullopt if k is out of range
+	std::optional<std::pair<PackedData, Int64>> nth(Int64 k);
+	// returns k pairs (key, rid) with loKey <= key <= hiKey drawn uniformly without replacement, in key order
+	// -- all of them if there are no more than k; each pair costs a descent like nth()
+	std::vector<std::pair<PackedData, Int64>> sample(const PackedData& loKey, const PackedData& hiKey, int k,
+		unsigned seed = 0);
+	// returns the number of pairs
+	Int64 size() const { return root->count; }
+	// record every insertion and removal in log; each call commits its records before it returns
+	// -- nullptr detaches the log
+	// commits: if false, committing is left to the caller, e.g., to commit after releasing a lock
+	// -- the lastLsn() of the log right after a call covers its records
+	// -- once the log has failed, a call that changes the index returns false: one that finds it failed applies
+	// nothing, while the one whose commit fails has its change applied in memory but not durable
+	void attachLog(WriteAheadLog* log, bool commits = true) { this->log = log; commitsLog = commits; }
+	// re-applies the insertions and removals recorded in the log at logPath, e.g., after a crash
+	// -- records already in the checkpoint the index was opened from are skipped
+	// returns the last lsn in the log
+	WriteAheadLog::Lsn replay(const std::string& logPath);
+	// writes the live (key, rid) pairs in key order and the schema to path, for open()
+	// -- path is replaced only once the checkpoint is complete
+	// -- the last lsn of the attached log is recorded, so that replay() after open() skips what the checkpoint has
+	// returns true if success
+	bool checkpoint(const std::string& path);
 	void dump(std::ostream& os = std::cout);
 	void checkIntegrity();
 
+	// defers: if true, operations only append to the root buffers, up to a hard limit of DEFERRED_LAZY_FACTOR times
+	// the usual size, and leave pushing them down to maintainPending(), e.g., from a background thread
+	void deferMaintenance(bool defers) { defersMaintenance = defers; }
+	// pushes down the root buffers if due, then compacts nodes holding kvsUnsorted or invalidated kvs
+	// -- compaction goes down paths from the root; at each level it follows the loaded child with the largest share
+	// of invalidated or unsorted kvs, and a random child if none has any
+	// returns the number of nodes worked on, at most about maxNodes; 0 if there was nothing to do
+	int maintainPending(int maxNodes);
+	// maxPushes: if positive, each insert/remove/update/apply pushes down at most this many nodes' buffers
+	// -- a push over the budget is carried forward and paid by later operations, oldest first
+	// -- buffers are still pushed regardless once they reach the hard limit of deferMaintenance()
+	// -- 0 for no limit
+	void setMaxPushesPerOperation(int maxPushes) { maxPushesPerOperation = maxPushes; }
+	// threshold: once selects since the last write to a node wasted this many entries on it, the select compacts
+	// the node and pushes down its buffers, so that later selects pay only the binary search
+	// -- 0, the default, turns it off; otherwise selects change the tree and must not run alongside each other,
+	// even though they only read -- about twice the branching factor, a hundred or so, pays off for select-heavy tables
+	void setReadCompactionThreshold(int threshold) { readCompactionThreshold = threshold; }
+	// lazySize: how many kvs each node buffers before pushing them down, sqrt(maxBranchingFactor) by default
+	// -- larger for insert-heavy tables, smaller for select-heavy ones; at most maxBranchingFactor
+	// -- nodes are laid out for the default, and larger buffers spill to the heap
+	void setLazySize(int lazySize);
+	int currentLazySize() const { return maxLazySize; }
+	// adapts: if true, the lazy size follows the observed ratio of inserted/removed kvs to selects
+	// -- selects then count what they see, so readers must not share the index
+	void adaptLazySize(bool adapts) { adaptsLazySize = adapts; }
+	// uses: if true, each node keeps a small filter over the keys of its buffers, and a leaf over its kvs, too,
+	// so that an equal search skips the nodes that surely lack the key, e.g., for the uniqueness check of insert()
+	// -- the filters are rebuilt as nodes are sorted or pushed down, and take FILTER_BITS_PER_KEY bits per kv a node
+	// is laid out for, beside the block
+	void useFilters(bool uses);
+
+	// with storage, even a select changes which nodes are in memory
+	bool hasStorage() const { return bufferPool != nullptr; }
+	// with storage: nodes in memory and pages read/written so far
+	int numLoadedNodes() const { return bufferPool == nullptr ? 0 : bufferPool->numResident(); }
+	long long numPageReads() const { return pageFile == nullptr ? 0 : pageFile->numReads(); }
+	long long numPageWrites() const { return pageFile == nullptr ? 0 : pageFile->numWrites(); }
+	// with storage: true once the page file could not be opened, read or written, or a node read back other than written
+	// -- from then on nothing is paged out, and a call that changes the index returns false as with a failed log
+	// (see attachLog()); checkpoint() and maintainPending() do nothing
+	// -- a node that could not be read is lost with its subtree, and goes on as an empty leaf, so that selects still
+	// run but may miss pairs
+	bool hasStorageFailed() const { return pageFile != nullptr && pageFile->hasFailed(); }
+	// nodes with kvs or buffers outgrown into the heap, beyond their blocks
+	int numSpilledNodes();
+
 private:
+	// nodes fixed during an operation stay pinned until the outermost operation ends
+	// -- without storage there is nothing to pin, and an operation touches no state, so that readers can share an Index
+	// (as long as read compaction is off)
+	struct Operation {
+		Index* index;
+		Operation(Index* index) : index(index->bufferPool == nullptr ? nullptr : index) {
+			if (this->index != nullptr)
+				this->index->operationDepth++;
+		}
+		~Operation() {
+			if (index != nullptr && --index->operationDepth == 0)
+				index->unpinFrom(0);
+		}
+	};
+	// the push budget of a mutating operation; the outermost one sets it, and spends what is left on overdue pushes
+	struct PushBudget {
+		Index* index;
+		PushBudget(Index* index) :
+			index(index->maxPushesPerOperation > 0 && index->pushBudget < 0 ? index : nullptr) {
+			if (this->index != nullptr)
+				this->index->pushBudget = this->index->maxPushesPerOperation;
+		}
+		~PushBudget() {
+			if (index == nullptr)
+				return;
+			index->payOverdue();
+			index->pushBudget = -1;
+		}
+	};
+
 	const bool allowsDuplicate;
+	const bool normalizesKey;
 	const int maxBranchingFactor;
-	const int maxLazySize;
+	// the lazy size the blocks of the nodes are laid out for
+	const int reservedLazySize;
+	int maxLazySize;
 	const std::vector<DataType> types;
 	const std::vector<std::string> names;
+	SlabPool nodePool;
+	std::unique_ptr<PageFile> pageFile;
+	std::unique_ptr<BufferPool> bufferPool;
+	// nodes pinned by the running operation, in the order they were fixed
+	std::vector<Node*> pinnedNodes;
+	int operationDepth;
+	WriteAheadLog* log;
+	bool commitsLog;
+	// changes of the log up to this lsn are reflected already: by the checkpoint opened, or by replay()
+	WriteAheadLog::Lsn appliedLsn;
+	bool defersMaintenance;
+	// picks the paths compacted by maintainPending() where no child looks worth it
+	std::minstd_rand sweepRandom;
+	int maxPushesPerOperation;
+	// pushes left to the running operation, or -1 for no limit
+	int pushBudget;
+	int readCompactionThreshold;
+	// a select marked nodes to push down once it is done
+	bool hasHotNodes;
+	bool adaptsLazySize;
+	// reads and written kvs seen, halved every ADAPT_WINDOW
+	long long numReadsSeen;
+	long long numWritesSeen;
+	bool usesFilters;
 	Node* root;
 
+	// log and insert one kv whose key is checked already, if necessary
+	// returns commitLog()
+	bool applyInsert(const PackedData& key, Int64 rid, PackedData&& internalKey);
+	// the rid of key in a unique index, from the pairs on the one path down to its leaf, or std::nullopt
+	std::optional<Int64> findRid(const PackedData& key);
 	Result insert(Node* curr, std::vector<KeyValue>&& tempKvs);
 	Result remove(Node* curr, std::vector<KeyValue>&& tempKvs);
 	std::vector<int> select(const PackedData& loKey, const PackedData& hiKey);
-	void select(Node* curr, const PackedData& loKey, const PackedData& hiKey, std::vector<int>& plus, std::vector<int>& minus);
+	// keyHash: for an equal search with filters, the hash of the user key
+	void select(Node* curr, const PackedData& loKey, const PackedData& hiKey, std::vector<int>& plus, std::vector<int>& minus,
+		std::optional<std::uint64_t> keyHash);
+	// a node and the sorted probes of selectMany() going through it, [from, to)
+	struct ProbeRange {
+		Node* node;
+		int from;
+		int to;
+	};
+	// add the pairs of curr in the ranges of probes [from, to) to plus and minus as (probe, rid), and return the
+	// children to visit next
+	void selectMany(const ProbeRange& range, const std::vector<PackedData>& los, const std::vector<PackedData>& his,
+		std::vector<std::pair<int, int>>& plus, std::vector<std::pair<int, int>>& minus, std::vector<ProbeRange>& next);
+	// add to the read cost of curr, compacting it or marking it hot past the threshold
+	void countReadCost(Node* curr, int cost);
+	// push down the buffers of the nodes marked hot
+	void pushHotNodes();
+	// count a public operation toward the adaptive lazy size
+	void observe(int numReads, int numWrites);
+	// number of pairs < key, or <= key if inclusive
+	Int64 countLess(const PackedData& key, bool inclusive);
+	// the k-th pair, which exists
+	std::pair<PackedData, Int64> findNth(Int64 k);
+	// count of curr from its buffers and its kvs or children, which are up to date
+	Int64 computeCount(Node* curr);
+	void recount(Node* curr) { curr->count = computeCount(curr); }
+	// hash of the user key part of an internal key, i.e., without the rid of a duplicate index
+	std::uint64_t hashUserKey(const PackedData& key);
+	// refill the filter of curr from its buffers and leaf kvs, or drop it without filters
+	void rebuildFilter(Node* curr);
+	void rebuildFilters(Node* curr);
+	void addToFilter(Node* curr, const KeyValue& kv);
+	// false if curr surely holds no kv with the user key of hash
+	bool mayContain(Node* curr, std::uint64_t hash);
+
+	// internal kvs of a batch, sorted, with the kvs in both cancelled out
+	void makeBatch(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+		const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove,
+		KeyValues& kvsToInsert, KeyValues& kvsToRemove);
+	// true if kvs, sorted, has two valid kvs with the same key, and the same rid too if comparesRid
+	bool hasRepeatedKeys(const KeyValues& kvs, bool comparesRid);
+	// returns the lsn of the last record, or 0 without a log
+	WriteAheadLog::Lsn logBatch(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+		const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove);
+	void applyBatch(KeyValues&& kvsToInsert, KeyValues&& kvsToRemove);
+	// false if the log or the page file failed before the index was changed
+	bool hasFailed() { return (log != nullptr && log->hasFailed()) || hasStorageFailed(); }
+	// commits up to lsn if this index commits the log; returns false if the log or the page file failed
+	bool commitLog(WriteAheadLog::Lsn lsn);
 
 	// merge unsortedKvs into kvs and remove invalid kvs
 	void sortKvs(Node* curr);
+	// lay the kvs and buffers of curr out in its block again once those that outgrew it fit there again
+	// -- a vector outgrowing its reservation lives on the heap for as long as it is large, e.g., until a split
+	void settle(Node* curr);
 	// remove kvs contained in both arrays
-	void removeDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValue>& kvs2);
+	void removeDuplicate(KeyValues& kvs1, KeyValues& kvs2);
 	// invalidate kvs contained in both arrays
-	void invalidateDuplicate(std::vector<KeyValue>& kvs1, std::vector<KeyValue>& kvs2);
+	void invalidateDuplicate(KeyValues& kvs1, KeyValues& kvs2);
 	void pushInsert(Node* curr);
 	void pushRemove(Node* curr);
 	// push down kvsToInsert/Remove if necessary
 	void push(Node* curr, bool forInsert);
 	// perform split, redistribute, merge if necessary
 	Result maintain(Node* curr);
+	// the split, redistribute or merge part of maintain()
+	Result rebalance(Node* curr);
+	// take the kvs pulled up from the children into kvsUnsorted, and the pending kvs they left into the buffers
+	void absorb(Node* curr, Result&& res);
+	// flag curr and its ancestors for payOverdue()
+	void markOverdue(Node* curr);
+	// push down the buffers of one overdue node in the subtree rooted at curr
+	Result payOverdue(Node* curr);
+	// spend the rest of pushBudget on overdue nodes
+	void payOverdue();
+	// split curr into as many nodes as needed so that each has at most maxBranchingFactor kvs
+	Result split(Node* curr);
 	// raise or lower the depth if necessary
 	void maintainRoot(Result&& res);
-	// find the smallest key in the subtree rooted at curr
+	// find the smallest key in the subtree rooted at curr, or the null key if it has none
 	PackedData findSmallestKey(Node* curr);
+	// kvs of [from, to) tie with key on the prefix; kvs before from are < key, and kvs from to on are > key
+	std::pair<int, int> narrowByPrefix(Node* curr, const PackedData& key, int hintPos);
 	// first iterator of kvs >= key
-	std::vector<KeyValue>::iterator lowerBound(Node* curr, const PackedData& key, int hintPos=0);
+	KeyValues::iterator lowerBound(Node* curr, const PackedData& key, int hintPos=0);
 	// first iterator of kvs > key
-	std::vector<KeyValue>::iterator upperBound(Node* curr, const PackedData& key, int hintPos=0);
+	KeyValues::iterator upperBound(Node* curr, const PackedData& key, int hintPos=0);
+
+	// replace the tree with one built bottom-up from sorted kvs
+	void build(std::vector<KeyValue>&& kvs, double fillFactor);
+
+	// a node lives at the start of a slot of nodePool, followed by its block
+	static size_t computeBlockOffset() { return (sizeof(Node) + SlabPool::SLOT_ALIGNMENT - 1) / SlabPool::SLOT_ALIGNMENT * SlabPool::SLOT_ALIGNMENT; }
+	Node* newNode(bool isLeaf);
+	void deleteNode(Node* node);
+	// point the child of *it back at parent
+	static void linkChild(Node* parent, KeyValues::iterator it);
 
-	void clean(Node* curr);
+	// with storage: load curr if paged out and pin it for the running operation
+	// -- curr becomes an empty leaf if it cannot be read (see hasStorageFailed())
+	void fix(Node* curr, bool isDirty = false);
+	// unpin the nodes pinned since pinnedNodes had mark of them, then page out down to the capacity
+	void unpinFrom(int mark);
+	// write curr back if dirty and give its frame to another node
+	// returns false, leaving curr in memory, if it could not be written
+	bool evict(Node* curr);
+	// keep one frame free for a node about to be loaded
+	void makeRoom();
+	// [image size], then kvs and buffers as [count, (key size, key bytes, value)...] per vector, over BLOCK_SIZE pages
+	// return false if a page could not be written or read
+	bool writeNode(Node* curr);
+	bool readNode(Node* curr);
+	// delete every node at once
+	void clean();
 
 	void dump(Node* curr, std::ostream& os);
-	void dump(const std::vector<KeyValue>& kvs, bool printsRID, std::ostream& os);
+	void dump(const KeyValues& kvs, bool printsRID, std::ostream& os);
 	void checkIntegrity(Node* curr, const PackedData& lb, bool existsLB, const PackedData& ub);
 
 	PackedData makeInternalKey(const PackedData& key, Int64 rid);
-	static int computeBranchingFactor(const std::vector<DataType>& types, int size);
+	PackedData makeUserKey(const PackedData& internalKey);
+	// big-endian, sign-flipped integers and terminated strings with 0x00 escaped as 0x00 0xFF
+	// -- memcmp on encoded keys orders them the same as comparePackData on the raw keys
+	PackedData encodeKey(const PackedData& key);
+	PackedData decodeKey(const PackedData& encodedKey);
+	// an Int64 that orders keys like comparePackData except for ties
+	// -- the leading integer column, or the first 8 bytes of a normalized key
+	bool hasKeyPrefix() const { return normalizesKey || types.front() != DataType::STRING; }
+	Int64 computePrefix(const PackedData& key);
+	// recompute prefixes after kvs has changed
+	void updatePrefixes(Node* curr);
+	static int computeBranchingFactor(int size);
 	int comparePackData(const PackedData& data1, const PackedData& data2);
 	bool compareKeyValue(const KeyValue& kv1, const KeyValue& kv2);
 	static bool isInvalid(const KeyValue& kv);
@@ -0,0 +1,232 @@
+#include "locked_index.h"
+
+#include <cassert>
+
+LockedIndex::LockedIndex(const std::vector<DataType>& types, const std::vector<std::string>& names,
+	bool allowsDuplicate, bool normalizesKey, const std::string& storagePath, int numFrames) :
+	index(types, names, allowsDuplicate, normalizesKey, storagePath, numFrames), log(nullptr), stopsMaintenance(false)
+{
+}
+
+LockedIndex::LockedIndex(Index&& index) :
+	index(std::move(index)), log(nullptr), stopsMaintenance(false)
+{
+	// selects share the index without storage, so they must not compact it or count themselves
+	if (!this->index.hasStorage()) {
+		this->index.setReadCompactionThreshold(0);
+		this->index.adaptLazySize(false);
+	}
+}
+
+LockedIndex::~LockedIndex()
+{
+	stopMaintenance();
+	std::lock_guard<std::mutex> registry(writersMutex);
+	for (auto writer : writers) {
+		writer->flush();
+		writer->index = nullptr;
+	}
+}
+
+bool LockedIndex::insert(const PackedData& key, Int64 rid, bool checksIntegrity)
+{
+	return write([&]() { return index.insert(key, rid, checksIntegrity); });
+}
+
+bool LockedIndex::insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity)
+{
+	return write([&]() { return index.insert(keys, rids, checksIntegrity); });
+}
+
+bool LockedIndex::remove(const PackedData& key, Int64 rid, bool checksIntegrity)
+{
+	return write([&]() { return index.remove(key, rid, checksIntegrity); });
+}
+
+bool LockedIndex::remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity)
+{
+	return write([&]() { return index.remove(keys, rids, checksIntegrity); });
+}
+
+bool LockedIndex::update(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+	const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove, bool checksIntegrity)
+{
+	return write([&]() { return index.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove, checksIntegrity); });
+}
+
+std::vector<int> LockedIndex::select(const PackedData& key)
+{
+	return read([&]() { return index.select(key); });
+}
+
+std::vector<int> LockedIndex::selectRange(const PackedData& loKey, const PackedData& hiKey)
+{
+	return read([&]() { return index.selectRange(loKey, hiKey); });
+}
+
+bool LockedIndex::select(const PackedData& key, Int64 rid)
+{
+	return read([&]() { return index.select(key, rid); });
+}
+
+LockedIndex::Writer LockedIndex::writer(int capacity)
+{
+	return Writer(this, capacity);
+}
+
+void LockedIndex::attachLog(WriteAheadLog* log)
+{
+	auto lock = lockForWrite();
+	this->log = log;
+	index.attachLog(log, false);
+}
+
+bool LockedIndex::checkpoint(const std::string& path)
+{
+	// writers wait, so that the checkpoint and the lsn it records agree
+	return read([&]() { return index.checkpoint(path); });
+}
+
+void LockedIndex::startMaintenance(double cpuBudget, int nodesPerSlice)
+{
+	assert(0 < cpuBudget && cpuBudget <= 1 && nodesPerSlice > 0);
+	stopMaintenance();
+	{
+		auto lock = lockForWrite();
+		index.deferMaintenance(true);
+	}
+	stopsMaintenance = false;
+	maintainer = std::thread([this, cpuBudget, nodesPerSlice]() { maintain(cpuBudget, nodesPerSlice); });
+}
+
+void LockedIndex::stopMaintenance()
+{
+	if (!maintainer.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> control(maintenanceMutex);
+		stopsMaintenance = true;
+	}
+	maintenanceWakeup.notify_all();
+	maintainer.join();
+	// the root buffers may be over the usual size, which the next operation pushes down
+	auto lock = lockForWrite();
+	index.deferMaintenance(false);
+}
+
+void LockedIndex::checkIntegrity()
+{
+	read([&]() { index.checkIntegrity(); });
+}
+
+bool LockedIndex::write(const std::function<bool()>& f)
+{
+	WriteAheadLog* attached;
+	WriteAheadLog::Lsn lsn = 0;
+	bool res;
+	{
+		auto lock = lockForWrite();
+		res = f();
+		attached = log;
+		if (attached != nullptr)
+			lsn = attached->lastLsn();
+	}
+	// a failed commit fails the call, though f has changed the index already
+	if (lsn != 0 && !attached->commit(lsn))
+		return false;
+	return res;
+}
+
+std::unique_lock<std::shared_mutex> LockedIndex::lockForWrite()
+{
+	std::lock_guard<std::mutex> entry(gate);
+	return std::unique_lock<std::shared_mutex>(latch);
+}
+
+LockedIndex::Writer::Writer(LockedIndex* index, int capacity) :
+	index(index), capacity(capacity)
+{
+	std::lock_guard<std::mutex> registry(index->writersMutex);
+	index->writers.insert(this);
+}
+
+LockedIndex::Writer::Writer(Writer&& other) noexcept :
+	index(nullptr), capacity(other.capacity),
+	keysToInsert(std::move(other.keysToInsert)), ridsToInsert(std::move(other.ridsToInsert)),
+	keysToRemove(std::move(other.keysToRemove)), ridsToRemove(std::move(other.ridsToRemove))
+{
+	if (other.index == nullptr)
+		return;
+	std::lock_guard<std::mutex> registry(other.index->writersMutex);
+	index = other.index;
+	other.index = nullptr;
+	index->writers.erase(&other);
+	index->writers.insert(this);
+}
+
+LockedIndex::Writer::~Writer()
+{
+	flush();
+	if (index == nullptr)
+		return;
+	std::lock_guard<std::mutex> registry(index->writersMutex);
+	index->writers.erase(this);
+}
+
+void LockedIndex::Writer::insert(const PackedData& key, Int64 rid)
+{
+	keysToInsert.push_back(key);
+	ridsToInsert.push_back(rid);
+	if (numStaged() >= capacity)
+		flush();
+}
+
+void LockedIndex::Writer::remove(const PackedData& key, Int64 rid)
+{
+	keysToRemove.push_back(key);
+	ridsToRemove.push_back(rid);
+	if (numStaged() >= capacity)
+		flush();
+}
+
+bool LockedIndex::Writer::flush()
+{
+	if (numStaged() == 0)
+		return true;
+	if (index == nullptr) {
+		keysToInsert.clear();
+		ridsToInsert.clear();
+		keysToRemove.clear();
+		ridsToRemove.clear();
+		return false;
+	}
+	auto update = index->index.prepare(std::move(keysToInsert), std::move(ridsToInsert),
+		std::move(keysToRemove), std::move(ridsToRemove));
+	keysToInsert.clear();
+	ridsToInsert.clear();
+	keysToRemove.clear();
+	ridsToRemove.clear();
+	return index->write([&]() { return index->index.apply(std::move(update)); });
+}
+
+void LockedIndex::maintain(double cpuBudget, int nodesPerSlice)
+{
+	std::unique_lock<std::mutex> control(maintenanceMutex);
+	while (!stopsMaintenance) {
+		control.unlock();
+		int numNodes = 0;
+		auto start = std::chrono::steady_clock::now();
+		{
+			std::unique_lock<std::shared_mutex> lock(latch, std::try_to_lock);
+			if (lock.owns_lock())
+				numNodes = index.maintainPending(nodesPerSlice);
+		}
+		auto busy = std::chrono::steady_clock::now() - start;
+		control.lock();
+
+		// busy for a slice, then resting busy * (1 - cpuBudget) / cpuBudget keeps to the budget
+		auto rest = numNodes == 0 ? std::chrono::nanoseconds(IDLE_WAIT) :
+			std::chrono::duration_cast<std::chrono::nanoseconds>(busy * ((1 - cpuBudget) / cpuBudget));
+		maintenanceWakeup.wait_for(control, rest, [this]() { return stopsMaintenance; });
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "index.h"
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <unordered_set>
+#include <shared_mutex>
+#include <condition_variable>
+
+// Index behind one reader/writer lock, for use from many threads
+// -- one lock for the whole tree rather than optimistic lock coupling with per-node versions: every write lands in
+// the root buffers first, so writers meet at the root anyway, and without per-node latches no reader can hold a
+// node another thread frees, so nothing needs epoch-based reclamation
+// -- selects share the lock and insertions and removals take it exclusively, so readers block behind a writer,
+// and a writer waits for the readers already in; nothing runs alongside a write
+// -- a waiting writer stops new readers from coming in, so that a steady stream of selects does not starve it
+// -- with storage, a select loads and evicts nodes, so selects take the lock exclusively as well and run one at
+// a time
+// -- with a log, records are appended under the lock and committed after it is released,
+// so that writers waiting on the lock can join the same group commit
+class LockedIndex {
+public:
+	// stages the insertions and removals of one thread and hands them over a batch at a time
+	// -- a full batch is encoded and sorted without the lock, which is then taken once to apply it as update() does
+	// -- staged changes are invisible until flush(); a thread removes only what it inserted itself or has seen flushed
+	// -- not thread-safe itself: one Writer per thread
+	// -- a Writer may outlive its index, which flushes it and lets it go on destruction; what the Writer stages
+	// afterwards is dropped, and flush() returns false
+	class Writer {
+	public:
+		Writer(Writer&& other) noexcept;
+		// flushes what is staged
+		~Writer();
+
+		void insert(const PackedData& key, Int64 rid);
+		void remove(const PackedData& key, Int64 rid);
+		// returns false if the log has failed, as Index::apply(), or the index is gone
+		bool flush();
+		int numStaged() const { return (int)(keysToInsert.size() + keysToRemove.size()); }
+	private:
+		friend class LockedIndex;
+		Writer(LockedIndex* index, int capacity);
+
+		LockedIndex* index;
+		int capacity;
+		std::vector<PackedData> keysToInsert;
+		std::vector<Int64> ridsToInsert;
+		std::vector<PackedData> keysToRemove;
+		std::vector<Int64> ridsToRemove;
+	};
+
+	LockedIndex(const std::vector<DataType>& types, const std::vector<std::string>& names, bool allowsDuplicate,
+		bool normalizesKey = false, const std::string& storagePath = "", int numFrames = 1024);
+	// takes over an index, e.g., from Index::open() or Index::bulkLoad()
+	explicit LockedIndex(Index&& index);
+	LockedIndex(const LockedIndex&) = delete;
+	// stops the maintenance thread, and flushes and lets go of the writers still alive, which must be idle by now
+	~LockedIndex();
+
+	// as in Index
+	bool insert(const PackedData& key, Int64 rid, bool checksIntegrity = false);
+	bool insert(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity = false);
+	bool remove(const PackedData& key, Int64 rid, bool checksIntegrity = false);
+	bool remove(const std::vector<PackedData>& keys, const std::vector<Int64>& rids, bool checksIntegrity = false);
+	bool update(const std::vector<PackedData>& keysToInsert, const std::vector<Int64>& ridsToInsert,
+		const std::vector<PackedData>& keysToRemove, const std::vector<Int64>& ridsToRemove, bool checksIntegrity = false);
+	std::vector<int> select(const PackedData& key);
+	std::vector<int> selectRange(const PackedData& loKey, const PackedData& hiKey);
+	bool select(const PackedData& key, Int64 rid);
+	// capacity: how many changes are staged before they are flushed
+	Writer writer(int capacity = 512);
+	void attachLog(WriteAheadLog* log);
+	bool checkpoint(const std::string& path);
+	// starts a thread that takes over pushing down the root buffers and compacting nodes (see Index::maintainPending())
+	// -- a slice of nodesPerSlice nodes starts only while the index is not locked, and then the thread rests
+	// long enough to stay within cpuBudget of one core
+	// -- a foreground operation still pushes down the root buffers itself once they reach the hard limit
+	void startMaintenance(double cpuBudget = 0.25, int nodesPerSlice = 16);
+	void stopMaintenance();
+	void checkIntegrity();
+private:
+	Index index;
+	std::shared_mutex latch;
+	// taken on the way to latch, and held by a writer until it gets latch
+	// -- std::shared_mutex lets a steady stream of readers starve writers; this gate stops new readers instead
+	std::mutex gate;
+	WriteAheadLog* log;
+	// the writers alive, detached on destruction so that none is left pointing here
+	std::unordered_set<Writer*> writers;
+	std::mutex writersMutex;
+
+	std::thread maintainer;
+	std::mutex maintenanceMutex;
+	std::condition_variable maintenanceWakeup;
+	bool stopsMaintenance;
+	// how long the maintenance thread waits when the index is busy or there is nothing to do
+	static constexpr std::chrono::milliseconds IDLE_WAIT{ 1 };
+
+	// runs f with the index locked for reading
+	template<typename F>
+	auto read(F&& f) {
+		std::unique_lock<std::mutex> entry(gate);
+		if (index.hasStorage()) {
+			std::unique_lock<std::shared_mutex> lock(latch);
+			entry.unlock();
+			return f();
+		}
+		std::shared_lock<std::shared_mutex> lock(latch);
+		entry.unlock();
+		return f();
+	}
+	void maintain(double cpuBudget, int nodesPerSlice);
+	// latch taken exclusively, through gate
+	std::unique_lock<std::shared_mutex> lockForWrite();
+	// runs f with the index locked for writing, then commits what f logged
+	bool write(const std::function<bool()>& f);
+};
@@ -0,0 +1,84 @@
+#include "slab_pool.h"
+
+#include <new>
+#include <cassert>
+#include <algorithm>
+
+SlabPool::SlabPool(size_t slotSize, int slotsPerSlab) :
+	_slotSize((slotSize + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT),
+	slotsPerSlab(slotsPerSlab), numUsedInLastSlab(slotsPerSlab), freeList(nullptr),
+	_numAllocated(0), _numAllocations(0)
+{
+	assert(slotsPerSlab > 0);
+}
+
+SlabPool::SlabPool(SlabPool&& other) noexcept :
+	_slotSize(other._slotSize), slotsPerSlab(other.slotsPerSlab), slabs(std::move(other.slabs)),
+	numUsedInLastSlab(other.numUsedInLastSlab), freeList(other.freeList),
+	_numAllocated(other._numAllocated), _numAllocations(other._numAllocations)
+{
+	other.slabs.clear();
+	other.numUsedInLastSlab = other.slotsPerSlab;
+	other.freeList = nullptr;
+	other._numAllocated = 0;
+}
+
+SlabPool::~SlabPool()
+{
+	release();
+}
+
+void* SlabPool::allocate()
+{
+	_numAllocated++;
+	_numAllocations++;
+	if (freeList != nullptr) {
+		auto slot = freeList;
+		freeList = freeList->next;
+		return slot;
+	}
+	if (numUsedInLastSlab == slotsPerSlab) {
+		slabs.push_back(static_cast<std::byte*>(
+			::operator new(_slotSize * slotsPerSlab, std::align_val_t{ SLOT_ALIGNMENT })));
+		numUsedInLastSlab = 0;
+	}
+	return slabs.back() + _slotSize * numUsedInLastSlab++;
+}
+
+void SlabPool::deallocate(void* slot)
+{
+	assert(_numAllocated > 0);
+	_numAllocated--;
+	auto freeSlot = static_cast<FreeSlot*>(slot);
+	freeSlot->next = freeList;
+	freeList = freeSlot;
+}
+
+void SlabPool::forEachAllocated(const std::function<void(void*)>& f)
+{
+	if (_numAllocated == 0)
+		return;
+	// a sorted array keeps teardown down to a single allocation
+	std::vector<void*> freeSlots;
+	for (auto slot = freeList; slot != nullptr; slot = slot->next)
+		freeSlots.push_back(slot);
+	std::sort(freeSlots.begin(), freeSlots.end());
+	for (int i = 0; i < (int)slabs.size(); i++) {
+		int n = i + 1 == (int)slabs.size() ? numUsedInLastSlab : slotsPerSlab;
+		for (int j = 0; j < n; j++) {
+			void* slot = slabs[i] + _slotSize * j;
+			if (!std::binary_search(freeSlots.begin(), freeSlots.end(), slot))
+				f(slot);
+		}
+	}
+}
+
+void SlabPool::release()
+{
+	for (auto slab : slabs)
+		::operator delete(slab, std::align_val_t{ SLOT_ALIGNMENT });
+	slabs.clear();
+	numUsedInLastSlab = slotsPerSlab;
+	freeList = nullptr;
+	_numAllocated = 0;
+}
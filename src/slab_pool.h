@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+// hands out fixed-size slots carved from large slabs and recycles freed slots through a free list
+// -- slots are aligned to SLOT_ALIGNMENT, and all slabs are released at once on destruction
+class SlabPool {
+public:
+	static constexpr size_t SLOT_ALIGNMENT = 64;
+
+	SlabPool(size_t slotSize, int slotsPerSlab);
+	SlabPool(SlabPool&& other) noexcept;
+	SlabPool(const SlabPool&) = delete;
+	~SlabPool();
+
+	void* allocate();
+	void deallocate(void* slot);
+	// calls f for every slot allocated and not yet deallocated
+	void forEachAllocated(const std::function<void(void*)>& f);
+	// releases every slab; slots in use must have been cleaned up by the caller
+	void release();
+
+	size_t slotSize() const { return _slotSize; }
+	int numSlabs() const { return (int)slabs.size(); }
+	int numAllocated() const { return _numAllocated; }
+	long long numAllocations() const { return _numAllocations; }
+private:
+	struct FreeSlot {
+		FreeSlot* next;
+	};
+
+	size_t _slotSize;
+	int slotsPerSlab;
+	std::vector<std::byte*> slabs;
+	// slots of the last slab that have never been handed out start at this position
+	int numUsedInLastSlab;
+	FreeSlot* freeList;
+	int _numAllocated;
+	long long _numAllocations;
+};
@@ -0,0 +1,558 @@
+#include "../index.h"
+#include "../locked_index.h"
+
+#include <new>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// counts heap allocations made through operator new
+static long long numAllocations = 0;
+
+// each operator delete below frees with the function matching its operator new: free() for malloc(), and for
+// aligned memory whatever pairs with the platform's aligned allocation
+// -- kept out of line, so that an inlined free() is not matched against the compiler's built-in operator new
+#ifdef _MSC_VER
+#define ALLOCATOR_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATOR_NOINLINE __attribute__((noinline))
+#endif
+
+ALLOCATOR_NOINLINE void* operator new(size_t size)
+{
+	numAllocations++;
+	if (void* ptr = std::malloc(size == 0 ? 1 : size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+ALLOCATOR_NOINLINE void* operator new(size_t size, std::align_val_t alignment)
+{
+	numAllocations++;
+	size_t a = static_cast<size_t>(alignment);
+#ifdef _WIN32
+	if (void* ptr = _aligned_malloc(size == 0 ? 1 : size, a))
+		return ptr;
+#else
+	if (void* ptr = std::aligned_alloc(a, (size + a - 1) / a * a))
+		return ptr;
+#endif
+	throw std::bad_alloc();
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { ::operator delete(ptr); }
+
+ALLOCATOR_NOINLINE void operator delete(void* ptr, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { ::operator delete(ptr, alignment); }
+
+class Stopwatch {
+public:
+	Stopwatch() : start(std::chrono::steady_clock::now()), allocations(numAllocations) {}
+	void report(const std::string& name) {
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << name << ": " << elapsed << " s, " << numAllocations - allocations << " allocations\n";
+		start = std::chrono::steady_clock::now();
+		allocations = numAllocations;
+	}
+private:
+	std::chrono::steady_clock::time_point start;
+	long long allocations;
+};
+
+std::vector<PackedData> makeKeys(int n)
+{
+	std::vector<PackedData> keys(n);
+	for (int i = 0; i < n; i++) {
+		keys[i] = PackedData(sizeof(Int64) + sizeof(Int32));
+		keys[i].push((Int64)rand());
+		keys[i].push((Int32)(rand() % 16));
+	}
+	return keys;
+}
+
+// node churn: splits while growing, merges and redistributions while shrinking, then teardown
+void churnBench(const int N) {
+	std::cout << "node churn bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	Stopwatch stopwatch;
+	auto tree = new Index(types, { "NUMBER", "COLOR" }, true);
+	for (int i = 0; i < N; i++)
+		tree->insert(keys[i], i + 1);
+	stopwatch.report("insert");
+
+	for (int loop = 0; loop < 2; loop++) {
+		for (int i = 0; i < N; i += 2)
+			tree->remove(keys[i], i + 1);
+		for (int i = 0; i < N; i += 2)
+			tree->insert(keys[i], i + 1);
+	}
+	stopwatch.report("remove/insert churn");
+
+	delete tree;
+	stopwatch.report("teardown");
+}
+
+// point selects on a timestamp index, the hot path of the key prefix search
+void pointSelectBench(const int N, bool normalizesKey) {
+	std::cout << "timestamp point select bench: N = " << N << ", normalizesKey = " << normalizesKey << "\n";
+	std::vector<DataType> types = { DataType::DATETIME };
+	std::vector<PackedData> keys(N);
+	for (int i = 0; i < N; i++) {
+		keys[i] = PackedData(sizeof(Int64));
+		keys[i].push((Int64)rand() * 1000 + rand() % 1000);
+	}
+
+	Index tree(types, { "TIMESTAMP" }, true, normalizesKey);
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+
+	Stopwatch stopwatch;
+	long long found = 0;
+	for (int i = 0; i < N; i++)
+		found += tree.select(keys[rand() % N]).size();
+	stopwatch.report("select");
+	std::cout << "found " << found << "\n";
+}
+
+// inserts and point selects with nodes paged out to a file
+void storageBench(const int N, int numFrames) {
+	std::cout << "storage bench: N = " << N << ", numFrames = " << numFrames << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	auto path = (std::filesystem::temp_directory_path() / "index_bench.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true, false, path, numFrames);
+
+	auto report = [&](long long& reads, long long& writes) {
+		std::cout << "page reads " << tree.numPageReads() - reads << ", page writes " << tree.numPageWrites() - writes << "\n";
+		reads = tree.numPageReads();
+		writes = tree.numPageWrites();
+	};
+	long long reads = 0, writes = 0;
+	Stopwatch stopwatch;
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+	stopwatch.report("insert");
+	report(reads, writes);
+
+	for (int i = 0; i < N; i++)
+		tree.select(keys[rand() % N], rand() % N + 1);
+	stopwatch.report("select");
+	report(reads, writes);
+}
+
+// restart: inserting every key again against opening a checkpoint
+void startupBench(const int N) {
+	std::cout << "startup bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	auto path = (std::filesystem::temp_directory_path() / "index_bench.ckpt").string();
+
+	Stopwatch stopwatch;
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+	stopwatch.report("insert");
+	tree.checkpoint(path);
+	stopwatch.report("checkpoint");
+	std::cout << "checkpoint size " << std::filesystem::file_size(path) << " bytes\n";
+	{
+		auto opened = Index::open(path);
+		stopwatch.report("open");
+	}
+	std::filesystem::remove(path);
+}
+
+// point selects from many threads: one mutex around an Index against LockedIndex
+void concurrentSelectBench(const int N, int numThreads) {
+	std::cout << "concurrent select bench: N = " << N << ", numThreads = " << numThreads << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	std::vector<Int64> rids(N);
+	for (int i = 0; i < N; i++)
+		rids[i] = i + 1;
+
+	auto run = [&](auto&& select) {
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&, t]() {
+				unsigned seed = t;
+				for (int i = t; i < N; i += numThreads)
+					select(keys[rand_r(&seed) % N]);
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+	};
+
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	tree.insert(keys, rids);
+	std::mutex mutex;
+	Stopwatch stopwatch;
+	run([&](const PackedData& key) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return tree.select(key);
+	});
+	stopwatch.report("select with one mutex");
+
+	LockedIndex locked(std::move(tree));
+	run([&](const PackedData& key) { return locked.select(key); });
+	stopwatch.report("select with LockedIndex");
+}
+
+// ingest from many threads: one lock per insertion against one per staged batch
+void ingestBench(const int N, int numThreads) {
+	std::cout << "concurrent ingest bench: N = " << N << ", numThreads = " << numThreads << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	for (bool stages : { false, true }) {
+		LockedIndex tree(types, { "NUMBER", "COLOR" }, true);
+		Stopwatch stopwatch;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&, t]() {
+				if (!stages) {
+					for (int i = t; i < N; i += numThreads)
+						tree.insert(keys[i], i + 1);
+					return;
+				}
+				auto writer = tree.writer();
+				for (int i = t; i < N; i += numThreads)
+					writer.insert(keys[i], i + 1);
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		stopwatch.report(stages ? "insert through writers" : "insert");
+	}
+}
+
+// foreground insert latency, with pushes done inline against a background maintenance thread
+void maintenanceBench(const int N) {
+	std::cout << "background maintenance bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	for (bool inBackground : { false, true }) {
+		LockedIndex tree(types, { "NUMBER", "COLOR" }, true);
+		if (inBackground)
+			tree.startMaintenance(0.5);
+		std::vector<double> latencies(N);
+		Stopwatch stopwatch;
+		for (int i = 0; i < N; i++) {
+			auto start = std::chrono::steady_clock::now();
+			tree.insert(keys[i], i + 1);
+			latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+		stopwatch.report(inBackground ? "insert with background maintenance" : "insert");
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "latency us: p50 " << latencies[N / 2] << ", p99 " << latencies[N / 100 * 99]
+			<< ", p99.9 " << latencies[N / 1000 * 999] << ", max " << latencies.back() << "\n";
+	}
+}
+
+// point selects after a stream of writes left the buffers and kvsUnsorted of the nodes full
+void readCompactionBench(const int N) {
+	std::cout << "read compaction bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	for (bool compacts : { false, true }) {
+		Index tree(types, { "NUMBER", "COLOR" }, true);
+		if (compacts)
+			tree.setReadCompactionThreshold(128);
+		for (int i = 0; i < N; i++)
+			tree.insert(keys[i], i + 1);
+		for (int i = 0; i < N; i += 2)
+			tree.remove(keys[i], i + 1);
+
+		Stopwatch stopwatch;
+		int count = 0;
+		for (int loop = 0; loop < 4; loop++)
+			for (int i = 0; i < N; i++)
+				count += tree.select(keys[i], i + 1);
+		stopwatch.report(compacts ? "select with read compaction" : "select");
+		std::cout << "found " << count << "\n";
+	}
+}
+
+// mixes of point selects and single insertions/removals over fixed and adaptive lazy sizes
+void lazySizeBench(const int N) {
+	std::cout << "lazy size bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	int defaultSize = Index(types, { "NUMBER", "COLOR" }, true).currentLazySize();
+
+	for (int readPercent : { 1, 50, 99 }) {
+		// 0 for adaptive
+		for (int lazySize : { 1, 2, defaultSize, defaultSize * 4, defaultSize * 16, 0 }) {
+			Index tree(types, { "NUMBER", "COLOR" }, true);
+			if (lazySize == 0)
+				tree.adaptLazySize(true);
+			else
+				tree.setLazySize(lazySize);
+			for (int i = 0; i < N / 2; i++)
+				tree.insert(keys[i], i + 1);
+			std::vector<int> isUsed(N);
+			std::fill(isUsed.begin(), isUsed.begin() + N / 2, 1);
+
+			std::mt19937 random(readPercent);
+			Stopwatch stopwatch;
+			int count = 0;
+			for (int i = 0; i < N; i++) {
+				int index = random() % N;
+				if ((int)(random() % 100) < readPercent) {
+					count += tree.select(keys[index], index + 1);
+					continue;
+				}
+				if (isUsed[index])
+					tree.remove(keys[index], index + 1);
+				else
+					tree.insert(keys[index], index + 1);
+				isUsed[index] = !isUsed[index];
+			}
+			stopwatch.report("reads " + std::to_string(readPercent) + "%, lazy size " +
+				(lazySize == 0 ? "adaptive " + std::to_string(tree.currentLazySize()) : std::to_string(lazySize)));
+			std::cout << "found " << count << "\n";
+		}
+	}
+}
+
+// counting the pairs of ranges of a thousandth of the keys, by scanning and from the subtree counts
+void countBench(const int N) {
+	std::cout << "count bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+	std::vector<PackedData> sorted;
+	auto cursor = tree.cursor();
+	for (cursor.seek(PackedData(types, { std::to_string(INT64_MIN), "0" })); cursor.valid(); cursor.next())
+		sorted.push_back(cursor.key());
+
+	const int M = 10'000;
+	const int width = std::max(1, N / 1000);
+	std::mt19937 random(0);
+	std::vector<int> los(M);
+	for (auto& lo : los)
+		lo = random() % std::max(1, N - width);
+
+	Stopwatch stopwatch;
+	long long total = 0;
+	for (int lo : los)
+		total += (long long)tree.selectRange(sorted[lo], sorted[lo + width - 1]).size();
+	stopwatch.report("selectRange().size()");
+	std::cout << "total " << total << "\n";
+	total = 0;
+	for (int lo : los)
+		total += tree.count(sorted[lo], sorted[lo + width - 1]);
+	stopwatch.report("count()");
+	std::cout << "total " << total << "\n";
+}
+
+// samples of a hundred pairs from a tenth of the keys, by selecting the range and from the subtree counts
+void sampleBench(const int N) {
+	std::cout << "sample bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+	auto lo = tree.nth(0)->first;
+	auto hi = tree.nth(N / 10)->first;
+
+	const int M = 100;
+	const int k = 100;
+	Stopwatch stopwatch;
+	long long total = 0;
+	for (int i = 0; i < M; i++) {
+		auto rids = tree.selectRange(lo, hi);
+		std::shuffle(rids.begin(), rids.end(), std::mt19937(i));
+		rids.resize(std::min((int)rids.size(), k));
+		total += rids.size();
+	}
+	stopwatch.report("selectRange() and shuffle");
+	for (int i = 0; i < M; i++)
+		total += tree.sample(lo, hi, k, i).size();
+	stopwatch.report("sample()");
+	std::cout << "total " << total << "\n";
+}
+
+// batches of point selects, one at a time and in one traversal
+void selectManyBench(const int N, int batchSize) {
+	std::cout << "select many bench: N = " << N << ", batchSize = " << batchSize << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	for (int i = 0; i < N; i++)
+		tree.insert(keys[i], i + 1);
+	std::vector<PackedData> probes(keys);
+	std::shuffle(probes.begin(), probes.end(), std::mt19937(0));
+
+	Stopwatch stopwatch;
+	long long total = 0;
+	for (auto& key : probes)
+		total += (long long)tree.select(key).size();
+	stopwatch.report("select");
+	for (int from = 0; from < N; from += batchSize) {
+		std::vector<PackedData> batch(probes.begin() + from, probes.begin() + std::min(N, from + batchSize));
+		total += (long long)tree.selectMany(batch).rids.size();
+	}
+	stopwatch.report("selectMany");
+	std::cout << "total " << total << "\n";
+}
+
+// primary-key inserts into a unique index: unchecked, checked in one descent, and upserts over taken keys
+void upsertBench(const int N) {
+	std::cout << "upsert bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	Index unchecked(types, { "NUMBER", "COLOR" }, false);
+	Stopwatch stopwatch;
+	for (int i = 0; i < N; i++)
+		unchecked.insert(keys[i], i + 1);
+	stopwatch.report("insert");
+	Index tree(types, { "NUMBER", "COLOR" }, false);
+	int numConflicts = 0;
+	for (int i = 0; i < N; i++)
+		numConflicts += tree.insertUnique(keys[i], i + 1).previousRid.has_value();
+	stopwatch.report("insertUnique");
+	int numReplaced = 0;
+	for (int i = 0; i < N; i++)
+		numReplaced += tree.upsert(keys[i], N + i + 1).previousRid.has_value();
+	stopwatch.report("upsert");
+	std::cout << "conflicts " << numConflicts << ", replaced " << numReplaced << "\n";
+}
+
+// inserts with the uniqueness check, which mostly misses, then equal searches of absent keys, with and without filters
+void filterBench(const int N) {
+	std::cout << "filter bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+	auto absentKeys = makeKeys(N);
+
+	for (bool usesFilters : { false, true }) {
+		Index tree(types, { "NUMBER", "COLOR" }, false);
+		tree.useFilters(usesFilters);
+		std::string suffix = usesFilters ? ", filters" : "";
+		Stopwatch stopwatch;
+		int numInserted = 0;
+		for (int i = 0; i < N; i++)
+			numInserted += tree.insert(keys[i], i + 1, true);
+		stopwatch.report("checked insert" + suffix);
+		long long total = 0;
+		for (auto& key : absentKeys)
+			total += (long long)tree.select(key).size();
+		stopwatch.report("absent select" + suffix);
+		std::cout << "inserted " << numInserted << ", total " << total << "\n";
+	}
+}
+
+// insertions and removals one at a time, with and without a bound on the pushes of each
+void pushBudgetBench(const int N) {
+	std::cout << "push budget bench: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(N);
+
+	for (int maxPushes : { 0, 1, 2 }) {
+		Index tree(types, { "NUMBER", "COLOR" }, true);
+		tree.setMaxPushesPerOperation(maxPushes);
+		std::vector<double> latencies(N * 2);
+		Stopwatch stopwatch;
+		for (int i = 0; i < N * 2; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (i < N)
+				tree.insert(keys[i], i + 1);
+			else
+				tree.remove(keys[i - N], i - N + 1);
+			latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+		stopwatch.report(maxPushes == 0 ? "insert then remove" : "insert then remove, pushes " + std::to_string(maxPushes));
+
+		// operations by latency, in buckets of powers of two microseconds
+		std::vector<int> histogram;
+		for (auto latency : latencies) {
+			int bucket = 0;
+			while ((1 << bucket) < latency)
+				bucket++;
+			histogram.resize(std::max((int)histogram.size(), bucket + 1));
+			histogram[bucket]++;
+		}
+		for (int bucket = 0; bucket < (int)histogram.size(); bucket++)
+			std::cout << "<= " << (1 << bucket) << " us: " << histogram[bucket] << "\n";
+		std::sort(latencies.begin(), latencies.end());
+		int M = N * 2;
+		std::cout << "latency us: p50 " << latencies[M / 2] << ", p99 " << latencies[M / 100 * 99]
+			<< ", p99.9 " << latencies[M / 1000 * 999] << ", max " << latencies.back() << "\n";
+	}
+}
+
+// concurrent committers, each waiting for its own record to be durable
+void walBench(const int M, int numThreads, WriteAheadLog::SyncMode mode) {
+	std::cout << "log commit bench: M = " << M << ", numThreads = " << numThreads
+		<< ", mode = " << (mode == WriteAheadLog::SyncMode::EACH ? "EACH" : "GROUP") << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto keys = makeKeys(M);
+	auto path = (std::filesystem::temp_directory_path() / "index_bench.log").string();
+	std::filesystem::remove(path);
+	{
+		WriteAheadLog log(path, mode);
+		Stopwatch stopwatch;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&log, &keys, t, numThreads, M]() {
+				for (int i = t; i < M; i += numThreads)
+					log.commit(log.append(WriteAheadLog::RecordType::INSERT, keys[i], i + 1));
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		stopwatch.report("commit");
+		std::cout << "syncs " << log.numSyncs() << "\n";
+	}
+	std::filesystem::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+	int n = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+	churnBench(n);
+	pointSelectBench(n, false);
+	pointSelectBench(n, true);
+	storageBench(n, 1024);
+	startupBench(n);
+	concurrentSelectBench(n, 8);
+	ingestBench(n, 8);
+	maintenanceBench(n);
+	pushBudgetBench(n);
+	readCompactionBench(n);
+	lazySizeBench(n);
+	countBench(n);
+	sampleBench(n);
+	for (int batchSize : { 64, 4096 })
+		selectManyBench(n, batchSize);
+	filterBench(n);
+	upsertBench(n);
+	for (auto mode : { WriteAheadLog::SyncMode::EACH, WriteAheadLog::SyncMode::GROUP })
+		for (int numThreads : { 1, 8 })
+			walBench(std::min(n, 20'000), numThreads, mode);
+}
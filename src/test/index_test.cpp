@@ -4,6 +4,10 @@
 #include <cassert>
 #include <numeric>
 #include <algorithm>
+#include <tuple>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
 
 void insertTest(const int N) {
 	std::cout << "insertion test: N = " << N << "\n";
@@ -188,8 +192,6 @@ void selectTest(const int N) {
 	for (int i = 0; i < N; i++) {
 		if (tree.select(packed[i], i + 1) != (isUsed[i] != 0)) {
 			tree.dump();
-			auto expected = (isUsed[i] != 0);
-			auto res = tree.select(packed[i], i + 1);
 		}
 		assert(tree.select(packed[i], i + 1) == (isUsed[i] != 0));
 	}
@@ -245,31 +247,1147 @@ void rangeSelectTest(const int N) {
 		flip(index);
 	}
 
+	// pairs of one key are in rid order, and rids follow indexes
 	std::vector<int> indirect(N);
 	std::iota(indirect.begin(), indirect.end(), 0);
-	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {return data[i] < data[j]; });
+	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {return std::tie(data[i], i) < std::tie(data[j], j); });
 
 	std::vector<int> inverted(N);
 	for (int i = 0; i < N; i++)
 		inverted[indirect[i]] = i;
 
+	// the rids come back in key order
 	for(int len=0, loop=0; loop < N && len < N*10; loop++){
 		int index1 = rand() % N;
 		int index2 = rand() % N;
 		if (data[index1] > data[index2])
 			std::swap(index1, index2);
 		auto res = tree.selectRange(packed[index1], packed[index2]);
-		std::sort(res.begin(), res.end());
 		std::vector<int> expected;
 		for (int i = inverted[index1]; i <= inverted[index2]; i++)
 			if(isUsed[indirect[i]])
 				expected.push_back(indirect[i]+1);
-		std::sort(expected.begin(), expected.end());
 		assert(res == expected);
 		len += res.size();
 	}
 }
 
+void batchTest(const int N) {
+	std::cout << "batched insertions and removals test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<std::vector<String>> data(N);
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < 2; j++)
+			data[i].push_back(std::to_string(rand()));
+		packed[i] = PackedData(types, data[i]);
+	}
+
+	for (int loop = 0; loop < 5; loop++) {
+		std::vector<PackedData> keysToInsert, keysToRemove;
+		std::vector<Int64> ridsToInsert, ridsToRemove;
+		std::vector<int> isTouched(N);
+		for (int i = 0; i < N; i++) {
+			int index = rand() % N;
+			if (isTouched[index])
+				continue;
+			isTouched[index] = true;
+			if (!isUsed[index]) {
+				keysToInsert.push_back(packed[index]);
+				ridsToInsert.push_back(index + 1);
+			}
+			else {
+				keysToRemove.push_back(packed[index]);
+				ridsToRemove.push_back(index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+		tree.checkIntegrity();
+
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[i], i + 1) == (isUsed[i] != 0));
+	}
+
+	// one batch may empty every child of the root at once
+	std::vector<PackedData> keysToRemove;
+	std::vector<Int64> ridsToRemove;
+	for (int i = 0; i < N; i++) {
+		if (!isUsed[i])
+			continue;
+		keysToRemove.push_back(packed[i]);
+		ridsToRemove.push_back(i + 1);
+	}
+	tree.update({}, {}, keysToRemove, ridsToRemove);
+	tree.checkIntegrity();
+	assert(tree.size() == 0);
+	for (int i = 0; i < N; i++)
+		assert(tree.select(packed[i]).empty());
+	tree.insert(packed[0], 1);
+	tree.checkIntegrity();
+	assert(tree.select(packed[0], 1));
+}
+
+// one batch removes a run of adjacent keys, which drains whole runs of adjacent nodes at every level at once
+void rangeBatchTest(const int N) {
+	std::cout << "range batch test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<PackedData> packed(N);
+	std::vector<Int64> rids(N);
+	std::vector<int> isUsed(N, 1);
+	for (int i = 0; i < N; i++) {
+		packed[i] = PackedData(types, { std::to_string(i), std::to_string(i % 3) });
+		rids[i] = i + 1;
+	}
+	tree.insert(packed, rids);
+
+	for (int loop = 0; loop < 4; loop++) {
+		// a run in the middle, then one from the front, then one to the back, then anywhere
+		int from = loop == 0 ? N / 6 : (loop == 1 ? 0 : rand() % N);
+		int to = loop == 0 ? N - N / 6 : (loop == 2 ? N : from + rand() % (N - from + 1));
+		std::vector<PackedData> keysToInsert, keysToRemove;
+		std::vector<Int64> ridsToInsert, ridsToRemove;
+		for (int i = from; i < to; i++) {
+			(isUsed[i] ? keysToRemove : keysToInsert).push_back(packed[i]);
+			(isUsed[i] ? ridsToRemove : ridsToInsert).push_back(rids[i]);
+			isUsed[i] = !isUsed[i];
+		}
+		tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+		tree.checkIntegrity();
+		assert(tree.size() == std::count(isUsed.begin(), isUsed.end(), 1));
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[i], rids[i]) == (isUsed[i] != 0));
+	}
+}
+
+void checkedBatchTest(const int N) {
+	std::cout << "checked batch test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index unique(types, { "NUMBER", "COLOR" }, false);
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<PackedData> packed(N);
+	std::vector<Int64> rids(N);
+	for (int i = 0; i < N; i++) {
+		packed[i] = PackedData(types, { std::to_string(i), std::to_string(rand() % 3) });
+		rids[i] = i + 1;
+	}
+	for (auto index : { &unique, &tree }) {
+		assert(index->update(packed, rids, {}, {}, true));
+		int victim = rand() % N;
+
+		// a batch inserting a new key twice breaks a unique index, and one inserting a pair twice breaks both,
+		// though each passes the check against the tree
+		auto fresh = PackedData(types, { std::to_string(N), "0" });
+		if (index == &unique)
+			assert(!index->update({ fresh, fresh }, { N + 1, N + 2 }, {}, {}, true));
+		assert(!index->update({ fresh, fresh }, { N + 1, N + 1 }, {}, {}, true));
+		// so does removing a pair twice
+		assert(!index->update({}, {}, { packed[victim], packed[victim] }, { victim + 1, victim + 1 }, true));
+
+		// nothing was applied
+		index->checkIntegrity();
+		assert(index->size() == N);
+		for (int i = 0; i < N; i++)
+			assert(index->select(packed[i], i + 1));
+		assert(index->update({}, {}, { packed[victim] }, { victim + 1 }, true));
+		assert(!index->select(packed[victim], victim + 1));
+	}
+}
+
+void burstTest(const int N) {
+	std::cout << "skewed burst insertion test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<PackedData> packed(N * 2);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand()) });
+	// the second half lands on a single key range
+	for (int i = N; i < N * 2; i++)
+		packed[i] = PackedData(types, { std::to_string(RAND_MAX / 2), std::to_string(i) });
+
+	for (int i = 0; i < N; i++)
+		tree.insert(packed[i], i + 1);
+	tree.checkIntegrity();
+
+	std::vector<PackedData> keys(packed.begin() + N, packed.end());
+	std::vector<Int64> rids(N);
+	std::iota(rids.begin(), rids.end(), N + 1);
+	tree.insert(keys, rids);
+	tree.checkIntegrity();
+
+	assert(tree.select(packed[N * 2 - 1]).size() == 1);
+	assert((int)tree.selectRange(packed[N], packed[N * 2 - 1]).size() == N);
+	for (int i = 0; i < N * 2; i++)
+		assert(tree.select(packed[i], i + 1));
+}
+
+void bulkLoadTest(const int N) {
+	std::cout << "bulk load test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+
+	std::vector<PackedData> packed(N);
+	std::vector<Int64> rids(N);
+	for (int i = 0; i < N; i++) {
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand()) });
+		rids[i] = i + 1;
+	}
+
+	for (double fillFactor : { 0.5, 0.7, 1.0 }) {
+		auto loaded = Index::bulkLoad(types, { "NUMBER", "COLOR" }, true, packed, rids, fillFactor);
+		assert(loaded.has_value());
+		auto& tree = *loaded;
+		tree.checkIntegrity();
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[i], i + 1));
+
+		// the loaded tree must keep working under updates
+		std::vector<int> isUsed(N, true);
+		for (int i = 0; i < N; i++) {
+			int index = rand() % N;
+			if (isUsed[index])
+				tree.remove(packed[index], index + 1);
+			else
+				tree.insert(packed[index], index + 1);
+			isUsed[index] = !isUsed[index];
+			tree.checkIntegrity();
+		}
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[i], i + 1) == (isUsed[i] != 0));
+	}
+
+	// a repeated pair, and a repeated key of a unique index, are refused
+	auto repeated = packed;
+	auto repeatedRids = rids;
+	repeated.push_back(packed[N / 2]);
+	repeatedRids.push_back(N / 2 + 1);
+	assert(!Index::bulkLoad(types, { "NUMBER", "COLOR" }, true, repeated, repeatedRids).has_value());
+	repeatedRids.back() = N + 1;
+	assert(Index::bulkLoad(types, { "NUMBER", "COLOR" }, true, repeated, repeatedRids).has_value());
+	assert(!Index::bulkLoad(types, { "NUMBER", "COLOR" }, false, repeated, repeatedRids).has_value());
+}
+
+void cursorTest(const int N) {
+	std::cout << "cursor test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<std::vector<int>> data(N);
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++) {
+		std::vector<String> str(2);
+		for (int j = 0; j < 2; j++) {
+			data[i].push_back(rand());
+			str[j] = std::to_string(data[i][j]);
+		}
+		packed[i] = PackedData(types, str);
+	}
+
+	for (int i = 0; i < N * 2; i++) {
+		int index = rand() % N;
+		if (!isUsed[index])
+			tree.insert(packed[index], index + 1);
+		else
+			tree.remove(packed[index], index + 1);
+		isUsed[index] = !isUsed[index];
+	}
+
+	std::vector<int> indirect(N);
+	std::iota(indirect.begin(), indirect.end(), 0);
+	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {return data[i] < data[j]; });
+
+	std::vector<int> inverted(N);
+	for (int i = 0; i < N; i++)
+		inverted[indirect[i]] = i;
+
+	auto cursor = tree.cursor();
+	for (int loop = 0; loop < N; loop++) {
+		int index = rand() % N;
+		int limit = rand() % 100;
+		int count = 0;
+		int i = inverted[index];
+		for (cursor.seek(packed[index]); cursor.valid() && count < limit; cursor.next(), count++) {
+			while (!isUsed[indirect[i]])
+				i++;
+			assert(cursor.rid() == indirect[i] + 1);
+			auto key = cursor.key();
+			assert(key.size() == packed[indirect[i]].size());
+			assert(std::memcmp(key.get(), packed[indirect[i]].get(), key.size()) == 0);
+			i++;
+		}
+		if (count < limit) {
+			while (i < N && !isUsed[indirect[i]])
+				i++;
+			assert(i == N);
+		}
+	}
+}
+
+void normalizedKeyTest(const int N) {
+	std::cout << "normalized key test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index normalized(types, { "NUMBER", "COLOR" }, true, true);
+
+	// negative keys check the sign flip
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand() - RAND_MAX / 2), std::to_string(rand() % 5 - 2) });
+
+	for (int i = 0; i < N * 2; i++) {
+		int index = rand() % N;
+		if (!isUsed[index]) {
+			tree.insert(packed[index], index + 1);
+			normalized.insert(packed[index], index + 1);
+		}
+		else {
+			tree.remove(packed[index], index + 1);
+			normalized.remove(packed[index], index + 1);
+		}
+		isUsed[index] = !isUsed[index];
+		normalized.checkIntegrity();
+	}
+
+	for (int i = 0; i < N; i++) {
+		assert(normalized.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(normalized.select(packed[i]) == tree.select(packed[i]));
+	}
+	for (int loop = 0; loop < N; loop++) {
+		int index1 = rand() % N;
+		int index2 = rand() % N;
+		assert(normalized.selectRange(packed[index1], packed[index2]) == tree.selectRange(packed[index1], packed[index2]));
+	}
+
+	auto cursor1 = tree.cursor();
+	auto cursor2 = normalized.cursor();
+	for (cursor1.seek(packed[0]), cursor2.seek(packed[0]); cursor1.valid(); cursor1.next(), cursor2.next()) {
+		assert(cursor2.valid());
+		assert(cursor1.rid() == cursor2.rid());
+		auto key1 = cursor1.key();
+		auto key2 = cursor2.key();
+		assert(key1.size() == key2.size());
+		assert(std::memcmp(key1.get(), key2.get(), key1.size()) == 0);
+	}
+	assert(!cursor2.valid());
+}
+
+void stringKeyTest(const int N) {
+	std::cout << "string key test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::STRING, DataType::INT32 };
+
+	// short and long strings, with embedded nulls
+	std::vector<std::pair<String, int>> data(N);
+	std::vector<PackedData> packed(N);
+	for (int i = 0; i < N; i++) {
+		int length = rand() % 3 == 0 ? rand() % 40 : rand() % 4;
+		for (int j = 0; j < length; j++)
+			data[i].first.push_back((char)(rand() % 4 == 0 ? '\0' : 'a' + rand() % 3));
+		data[i].second = rand() % 3;
+		packed[i] = PackedData(types, { data[i].first, std::to_string(data[i].second) });
+	}
+
+	std::vector<int> indirect(N);
+	std::iota(indirect.begin(), indirect.end(), 0);
+	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {return std::make_pair(data[i], i) < std::make_pair(data[j], j); });
+
+	for (bool normalizesKey : { false, true }) {
+		Index tree(types, { "NAME", "COLOR" }, true, normalizesKey);
+		std::vector<int> isUsed(N);
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % N;
+			if (!isUsed[index])
+				tree.insert(packed[index], index + 1);
+			else
+				tree.remove(packed[index], index + 1);
+			isUsed[index] = !isUsed[index];
+			tree.checkIntegrity();
+		}
+
+		for (int loop = 0; loop < N; loop++) {
+			int index1 = rand() % N;
+			int index2 = rand() % N;
+			if (data[index2] < data[index1])
+				std::swap(index1, index2);
+			std::vector<int> expected;
+			for (auto i : indirect)
+				if (isUsed[i] && !(data[i] < data[index1]) && !(data[index2] < data[i]))
+					expected.push_back(i + 1);
+			assert(tree.selectRange(packed[index1], packed[index2]) == expected);
+		}
+	}
+}
+
+void blockLayoutTest(const int N) {
+	std::cout << "block layout test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	// every round fills the buffers and pushes them down; the space a vector leaves as it moves is taken again
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand()) });
+	for (int round = 0; round < 10; round++) {
+		for (int i = 0; i < N; i++) {
+			int index = rand() % N;
+			if (!isUsed[index])
+				tree.insert(packed[index], index + 1);
+			else
+				tree.remove(packed[index], index + 1);
+			isUsed[index] = !isUsed[index];
+		}
+		tree.checkIntegrity();
+		assert(tree.numSpilledNodes() == 0);
+	}
+}
+
+void prefixTieTest(const int N) {
+	std::cout << "key prefix tie test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::DATE, DataType::INT64 };
+
+	// few distinct leading values, so most searches tie on the prefix
+	std::vector<std::pair<int, long long>> data(N);
+	std::vector<PackedData> packed(N);
+	for (int i = 0; i < N; i++) {
+		data[i] = { rand() % 5 - 2, (long long)rand() - RAND_MAX / 2 };
+		packed[i] = PackedData(types, { std::to_string(data[i].first), std::to_string(data[i].second) });
+	}
+
+	std::vector<int> indirect(N);
+	std::iota(indirect.begin(), indirect.end(), 0);
+	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {return std::make_pair(data[i], i) < std::make_pair(data[j], j); });
+
+	for (bool normalizesKey : { false, true }) {
+		Index tree(types, { "DAY", "NUMBER" }, true, normalizesKey);
+		std::vector<int> isUsed(N);
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % N;
+			if (!isUsed[index])
+				tree.insert(packed[index], index + 1);
+			else
+				tree.remove(packed[index], index + 1);
+			isUsed[index] = !isUsed[index];
+			tree.checkIntegrity();
+		}
+
+		for (int loop = 0; loop < N; loop++) {
+			int index1 = rand() % N;
+			int index2 = rand() % N;
+			if (data[index2] < data[index1])
+				std::swap(index1, index2);
+			std::vector<int> expected;
+			for (auto i : indirect)
+				if (isUsed[i] && !(data[i] < data[index1]) && !(data[index2] < data[i]))
+					expected.push_back(i + 1);
+			assert(tree.selectRange(packed[index1], packed[index2]) == expected);
+			assert(tree.select(packed[index1], index1 + 1) == (isUsed[index1] != 0));
+		}
+	}
+}
+
+void storageTest(const int N) {
+	std::cout << "storage test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	const int numFrames = 4;
+	auto path = (std::filesystem::temp_directory_path() / "index_storage_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, numFrames);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// single and batched operations, with far fewer frames than nodes
+	for (int i = 0; i < N * 2; i++) {
+		if (rand() % 4 == 0) {
+			std::vector<PackedData> keysToInsert, keysToRemove;
+			std::vector<Int64> ridsToInsert, ridsToRemove;
+			for (int j = 0; j < 8; j++) {
+				int index = rand() % N;
+				if (std::find(ridsToInsert.begin(), ridsToInsert.end(), index + 1) != ridsToInsert.end() ||
+					std::find(ridsToRemove.begin(), ridsToRemove.end(), index + 1) != ridsToRemove.end())
+					continue;
+				(isUsed[index] ? keysToRemove : keysToInsert).push_back(packed[index]);
+				(isUsed[index] ? ridsToRemove : ridsToInsert).push_back(index + 1);
+				isUsed[index] = !isUsed[index];
+			}
+			tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+			stored.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+		}
+		else {
+			int index = rand() % N;
+			if (!isUsed[index]) {
+				tree.insert(packed[index], index + 1);
+				stored.insert(packed[index], index + 1);
+			}
+			else {
+				tree.remove(packed[index], index + 1);
+				stored.remove(packed[index], index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		assert(stored.numLoadedNodes() <= numFrames);
+		if (i % (N / 10 + 1) == 0)
+			stored.checkIntegrity();
+	}
+	stored.checkIntegrity();
+	assert(stored.numLoadedNodes() <= numFrames);
+	// a kv takes at least 64 bytes with its prefix, so the nodes outgrow the frames once a quarter of the keys is in
+	assert(N / 4 * 64 <= numFrames * BLOCK_SIZE || (stored.numPageReads() > 0 && stored.numPageWrites() > 0));
+
+	for (int i = 0; i < N; i++) {
+		assert(stored.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(stored.select(packed[i]) == tree.select(packed[i]));
+	}
+	for (int loop = 0; loop < N; loop++) {
+		int index1 = rand() % N;
+		int index2 = rand() % N;
+		assert(stored.selectRange(packed[index1], packed[index2]) == tree.selectRange(packed[index1], packed[index2]));
+	}
+	assert(stored.numLoadedNodes() <= numFrames);
+}
+
+void storageFailureTest(const int N) {
+	std::cout << "storage failure test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_storage_failure_test.pages").string();
+
+	// a page file that cannot be opened: nothing is paged out, and changes are refused
+	Index unopened(types, { "NUMBER", "COLOR" }, true, false,
+		(std::filesystem::temp_directory_path() / "missing_directory" / "index.pages").string(), 4);
+	assert(unopened.hasStorageFailed());
+	assert(!unopened.insert(PackedData(types, { "1", "1" }), 1));
+	assert(unopened.size() == 0);
+
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, 4);
+	std::vector<PackedData> packed(N);
+	for (int i = 0; i < N; i++) {
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+		assert(stored.insert(packed[i], i + 1));
+	}
+	assert(!stored.hasStorageFailed());
+	if (stored.numPageWrites() == 0)
+		return;
+
+	// pages cut off behind the index's back cannot be read again; operations that run into them go on, and the
+	// index refuses changes from then on
+	// -- a scan of every key runs into the nodes paged out at the cut, unless a small tree had all but a few of
+	// them in memory and wrote those again before the scan read them; kvs take at least 64 bytes, so a tree four
+	// times the size of the frames cannot
+	std::filesystem::resize_file(path, 0);
+	stored.selectRange(PackedData(types, { "-1", "0" }), PackedData(types, { std::to_string(RAND_MAX), "3" }));
+	assert(N * 64 <= 16 * BLOCK_SIZE || stored.hasStorageFailed());
+	if (!stored.hasStorageFailed())
+		return;
+	for (int i = 0; i < N; i++) {
+		assert(i % 2 == 0 ? !stored.remove(packed[i], i + 1) : !stored.insert(packed[i], N + i + 1));
+		stored.select(packed[rand() % N]);
+	}
+	assert(!stored.checkpoint(path + ".checkpoint"));
+	assert(stored.maintainPending(N) == 0);
+	stored.selectRange(packed[0], packed[N - 1]);
+}
+
+void checkpointTest(const int N) {
+	std::cout << "checkpoint test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::STRING, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_checkpoint_test.ckpt").string();
+	auto storagePath = (std::filesystem::temp_directory_path() / "index_checkpoint_test.pages").string();
+
+	for (bool normalizesKey : { false, true }) {
+		Index tree(types, { "NAME", "COLOR" }, true, normalizesKey);
+		std::vector<PackedData> packed(N);
+		std::vector<int> isUsed(N);
+		for (int i = 0; i < N; i++)
+			packed[i] = PackedData(types, { std::string(rand() % 40, 'a' + rand() % 26), std::to_string(rand() % 3) });
+		// leave kvs pending in the buffers of internal nodes
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % N;
+			if (!isUsed[index])
+				tree.insert(packed[index], index + 1);
+			else
+				tree.remove(packed[index], index + 1);
+			isUsed[index] = !isUsed[index];
+		}
+		assert(tree.checkpoint(path));
+
+		for (auto& storage : { std::string(), storagePath }) {
+			auto opened = Index::open(path, 0.7, storage, 4);
+			assert(opened.has_value());
+			opened->checkIntegrity();
+			for (int i = 0; i < N; i++) {
+				assert(opened->select(packed[i], i + 1) == (isUsed[i] != 0));
+				assert(opened->select(packed[i]) == tree.select(packed[i]));
+			}
+
+			// the opened index takes further changes
+			for (int i = 0; i < N; i++) {
+				if (!isUsed[i])
+					assert(opened->insert(packed[i], i + 1, true));
+			}
+			opened->checkIntegrity();
+			for (int i = 0; i < N; i++)
+				assert(opened->select(packed[i], i + 1));
+		}
+
+		// a footer with more entries than the file holds or an unknown column type is rejected
+		// -- the footer is numEntries, lsn, two flags and numColumns, then the type of each column
+		auto corrupt = [&path](std::streamoff offsetInFooter, auto value) {
+			std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+			Int64 footerOffset;
+			file.seekg(-(std::streamoff)(sizeof(footerOffset) + 8), std::ios::end);
+			file.read(reinterpret_cast<char*>(&footerOffset), sizeof(footerOffset));
+			file.seekp(footerOffset + offsetInFooter);
+			file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		};
+		corrupt(0, (Int64)1 << 40);
+		assert(!Index::open(path).has_value());
+		assert(tree.checkpoint(path));
+		corrupt(sizeof(Int64) * 2 + 2 + sizeof(Int32), (Int32)100);
+		assert(!Index::open(path).has_value());
+		assert(tree.checkpoint(path));
+
+		// a cut checkpoint is rejected
+		std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+		assert(!Index::open(path).has_value());
+	}
+	std::filesystem::remove(path);
+}
+
+void deferredMaintenanceTest(const int N) {
+	std::cout << "deferred maintenance test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index deferred(types, { "NUMBER", "COLOR" }, true);
+	deferred.deferMaintenance(true);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// maintenance in slices of assorted sizes between the operations
+	for (int i = 0; i < N * 3; i++) {
+		int index = rand() % N;
+		if (!isUsed[index]) {
+			tree.insert(packed[index], index + 1);
+			deferred.insert(packed[index], index + 1);
+		}
+		else {
+			tree.remove(packed[index], index + 1);
+			deferred.remove(packed[index], index + 1);
+		}
+		isUsed[index] = !isUsed[index];
+		if (rand() % 8 == 0)
+			deferred.maintainPending(1 + rand() % 4);
+		if (i % (N / 10 + 1) == 0)
+			deferred.checkIntegrity();
+	}
+	deferred.checkIntegrity();
+	for (int i = 0; i < N; i++) {
+		assert(deferred.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(deferred.select(packed[i]) == tree.select(packed[i]));
+	}
+
+	// draining leaves nothing to do
+	for (int loop = 0; loop < 1000 && deferred.maintainPending(N) > 0; loop++);
+	deferred.checkIntegrity();
+	for (int i = 0; i < N; i++)
+		assert(deferred.select(packed[i], i + 1) == (isUsed[i] != 0));
+}
+
+void boundedMaintenanceTest(const int N) {
+	std::cout << "bounded maintenance test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_bounded_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index bounded(types, { "NUMBER", "COLOR" }, true);
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, 4);
+	bounded.setMaxPushesPerOperation(1);
+	stored.setMaxPushesPerOperation(2);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// single and batched operations, most of whose pushes are carried forward
+	for (int i = 0; i < N * 3; i++) {
+		if (rand() % 8 == 0) {
+			std::vector<PackedData> keysToInsert, keysToRemove;
+			std::vector<Int64> ridsToInsert, ridsToRemove;
+			for (int j = 0; j < 64; j++) {
+				int index = rand() % N;
+				if (std::find(ridsToInsert.begin(), ridsToInsert.end(), index + 1) != ridsToInsert.end() ||
+					std::find(ridsToRemove.begin(), ridsToRemove.end(), index + 1) != ridsToRemove.end())
+					continue;
+				(isUsed[index] ? keysToRemove : keysToInsert).push_back(packed[index]);
+				(isUsed[index] ? ridsToRemove : ridsToInsert).push_back(index + 1);
+				isUsed[index] = !isUsed[index];
+			}
+			tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+			bounded.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+			stored.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+		}
+		else {
+			int index = rand() % N;
+			if (!isUsed[index]) {
+				tree.insert(packed[index], index + 1);
+				bounded.insert(packed[index], index + 1);
+				stored.insert(packed[index], index + 1);
+			}
+			else {
+				tree.remove(packed[index], index + 1);
+				bounded.remove(packed[index], index + 1);
+				stored.remove(packed[index], index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		if (i % (N / 10 + 1) == 0) {
+			bounded.checkIntegrity();
+			stored.checkIntegrity();
+		}
+	}
+	bounded.checkIntegrity();
+	stored.checkIntegrity();
+	for (int i = 0; i < N; i++) {
+		assert(bounded.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(bounded.select(packed[i]) == tree.select(packed[i]));
+		assert(stored.select(packed[i]) == tree.select(packed[i]));
+	}
+
+	// back to no limit, the carried pushes are paid as they come
+	bounded.setMaxPushesPerOperation(0);
+	for (int i = 0; i < N; i++) {
+		if (isUsed[i])
+			bounded.remove(packed[i], i + 1);
+	}
+	bounded.checkIntegrity();
+	for (int i = 0; i < N; i++)
+		assert(bounded.select(packed[i]).empty());
+	std::filesystem::remove(path);
+}
+
+void readCompactionTest(const int N) {
+	std::cout << "read compaction test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_read_compaction_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index compacted(types, { "NUMBER", "COLOR" }, true);
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, 4);
+	compacted.setReadCompactionThreshold(1 + rand() % 8);
+	stored.setReadCompactionThreshold(1 + rand() % 8);
+	if (N % 2 == 0)
+		compacted.setMaxPushesPerOperation(1);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// bursts of writes, each followed by a burst of selects that compact what they pass
+	for (int loop = 0; loop < 4; loop++) {
+		for (int i = 0; i < N; i++) {
+			int index = rand() % N;
+			if (!isUsed[index]) {
+				tree.insert(packed[index], index + 1);
+				compacted.insert(packed[index], index + 1);
+				stored.insert(packed[index], index + 1);
+			}
+			else {
+				tree.remove(packed[index], index + 1);
+				compacted.remove(packed[index], index + 1);
+				stored.remove(packed[index], index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % N;
+			assert(compacted.select(packed[index], index + 1) == (isUsed[index] != 0));
+			assert(compacted.select(packed[index]) == tree.select(packed[index]));
+			assert(stored.select(packed[index]) == tree.select(packed[index]));
+		}
+		compacted.checkIntegrity();
+		stored.checkIntegrity();
+	}
+	for (int i = 0; i < N; i++) {
+		assert(compacted.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(stored.select(packed[i], i + 1) == (isUsed[i] != 0));
+	}
+	std::filesystem::remove(path);
+}
+
+void lazySizeTest(const int N) {
+	std::cout << "lazy size test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index resized(types, { "NUMBER", "COLOR" }, true);
+	Index adaptive(types, { "NUMBER", "COLOR" }, true);
+	adaptive.adaptLazySize(true);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// phases of write-heavy and read-heavy mixes, with the lazy size changed between them
+	for (int loop = 0; loop < 6; loop++) {
+		int lazySizes[] = { 1, 2, tree.currentLazySize(), tree.currentLazySize() * 8, 1 << 20 };
+		resized.setLazySize(lazySizes[rand() % 5]);
+		int readPercent = loop % 2 == 0 ? 5 : 95;
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % N;
+			if (rand() % 100 < readPercent) {
+				assert(resized.select(packed[index]) == tree.select(packed[index]));
+				assert(adaptive.select(packed[index], index + 1) == (isUsed[index] != 0));
+				continue;
+			}
+			if (!isUsed[index]) {
+				tree.insert(packed[index], index + 1);
+				resized.insert(packed[index], index + 1);
+				adaptive.insert(packed[index], index + 1);
+			}
+			else {
+				tree.remove(packed[index], index + 1);
+				resized.remove(packed[index], index + 1);
+				adaptive.remove(packed[index], index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		resized.checkIntegrity();
+		adaptive.checkIntegrity();
+	}
+	for (int i = 0; i < N; i++) {
+		assert(resized.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(adaptive.select(packed[i]) == tree.select(packed[i]));
+	}
+}
+
+void countTest(const int N) {
+	std::cout << "count test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_count_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, 4);
+	tree.setLazySize(1 + rand() % 16);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N + 1)), std::to_string(rand() % 3) });
+
+	for (int loop = 0; loop < 3; loop++) {
+		for (int i = 0; i < N; i++) {
+			if (rand() % 8 == 0) {
+				std::vector<PackedData> keysToInsert, keysToRemove;
+				std::vector<Int64> ridsToInsert, ridsToRemove;
+				for (int j = 0; j < 16; j++) {
+					int index = rand() % N;
+					if (std::find(ridsToInsert.begin(), ridsToInsert.end(), index + 1) != ridsToInsert.end() ||
+						std::find(ridsToRemove.begin(), ridsToRemove.end(), index + 1) != ridsToRemove.end())
+						continue;
+					(isUsed[index] ? keysToRemove : keysToInsert).push_back(packed[index]);
+					(isUsed[index] ? ridsToRemove : ridsToInsert).push_back(index + 1);
+					isUsed[index] = !isUsed[index];
+				}
+				tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+				stored.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+				continue;
+			}
+			int index = rand() % N;
+			if (!isUsed[index]) {
+				tree.insert(packed[index], index + 1);
+				stored.insert(packed[index], index + 1);
+			}
+			else {
+				tree.remove(packed[index], index + 1);
+				stored.remove(packed[index], index + 1);
+			}
+			isUsed[index] = !isUsed[index];
+		}
+		tree.checkIntegrity();
+		stored.checkIntegrity();
+
+		// the pairs in key order, as the cursor sees them
+		std::vector<Int64> order;
+		std::vector<int> position(N + 1);
+		auto cursor = tree.cursor();
+		for (cursor.seek(PackedData(types, { std::to_string(INT64_MIN), "0" })); cursor.valid(); cursor.next()) {
+			position[cursor.rid()] = (int)order.size();
+			order.push_back(cursor.rid());
+		}
+		assert(tree.size() == (Int64)order.size());
+		assert(stored.size() == (Int64)order.size());
+		for (int i = 0; i < (int)order.size(); i++) {
+			assert(tree.nth(i)->second == order[i]);
+			assert(stored.nth(i)->second == order[i]);
+		}
+		assert(!tree.nth((Int64)order.size()).has_value());
+		assert(!tree.nth(-1).has_value());
+
+		for (int i = 0; i < N; i++) {
+			auto& lo = packed[i];
+			auto& hi = packed[rand() % N];
+			Int64 expected = (Int64)tree.selectRange(lo, hi).size();
+			assert(tree.count(lo, hi) == expected);
+			assert(stored.count(lo, hi) == expected);
+
+			cursor.seek(lo);
+			Int64 rank = cursor.valid() ? position[cursor.rid()] : (Int64)order.size();
+			assert(tree.rank(lo) == rank);
+			assert(stored.rank(lo) == rank);
+		}
+	}
+	std::filesystem::remove(path);
+}
+
+void sampleTest(const int N) {
+	std::cout << "sample test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N + 1)), std::to_string(rand() % 3) });
+	// leave pending insertions and removals in the buffers
+	for (int i = 0; i < N * 2; i++) {
+		int index = rand() % N;
+		if (!isUsed[index])
+			tree.insert(packed[index], index + 1);
+		else
+			tree.remove(packed[index], index + 1);
+		isUsed[index] = !isUsed[index];
+	}
+
+	for (int loop = 0; loop < 8; loop++) {
+		auto& lo = packed[rand() % N];
+		auto& hi = packed[rand() % N];
+		auto inRange = tree.selectRange(lo, hi);
+		int k = rand() % (N / 4 + 2);
+		unsigned seed = rand();
+		auto samples = tree.sample(lo, hi, k, seed);
+		assert((int)samples.size() == std::min(k, (int)inRange.size()));
+		std::vector<int> rids;
+		for (auto& [key, rid] : samples) {
+			assert(isUsed[rid - 1] && tree.select(key, rid));
+			assert(std::find(inRange.begin(), inRange.end(), (int)rid) != inRange.end());
+			rids.push_back((int)rid);
+		}
+		std::sort(rids.begin(), rids.end());
+		assert(std::adjacent_find(rids.begin(), rids.end()) == rids.end());
+		// the same seed draws the same sample
+		auto again = tree.sample(lo, hi, k, seed);
+		for (int i = 0; i < (int)samples.size(); i++)
+			assert(again[i].second == samples[i].second);
+	}
+
+	// single draws over the whole tree hit every pair about equally often
+	if (N > 100 || tree.size() == 0)
+		return;
+	const int draws = 400;
+	std::vector<int> hits(N + 1);
+	auto lo = PackedData(types, { std::to_string(INT64_MIN), "0" });
+	auto hi = PackedData(types, { std::to_string(INT64_MAX), "0" });
+	for (int i = 0; i < draws * (int)tree.size(); i++)
+		hits[tree.sample(lo, hi, 1, i).front().second]++;
+	for (int i = 0; i < N; i++)
+		assert(isUsed[i] ? (hits[i + 1] > draws / 2 && hits[i + 1] < draws * 2) : hits[i + 1] == 0);
+}
+
+void selectManyTest(const int N) {
+	std::cout << "select many test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_select_many_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	Index stored(types, { "NUMBER", "COLOR" }, true, false, path, 4);
+	Index unique(types, { "NUMBER", "COLOR" }, false);
+
+	// few distinct keys, so that a key has many rids spread over several leaves
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N / 8 + 1)), std::to_string(rand() % 3) });
+	for (int i = 0; i < N * 2; i++) {
+		int index = rand() % N;
+		if (!isUsed[index]) {
+			tree.insert(packed[index], index + 1);
+			stored.insert(packed[index], index + 1);
+		}
+		else {
+			tree.remove(packed[index], index + 1);
+			stored.remove(packed[index], index + 1);
+		}
+		isUsed[index] = !isUsed[index];
+		// a key keeps the rid it got first
+		unique.insert(packed[index], index + 1, true);
+	}
+
+	// keys in random order, repeated, and some not in the tree
+	std::vector<PackedData> keys;
+	for (int i = 0; i < N; i++)
+		keys.push_back(rand() % 4 == 0 ?
+			PackedData(types, { std::to_string(rand() % (N / 4 + 1)), std::to_string(rand() % 4) }) : packed[rand() % N]);
+	for (auto index : { &tree, &stored, &unique }) {
+		auto res = index->selectMany(keys);
+		assert((int)res.offsets.size() == N + 1 && res.offsets.front() == 0);
+		assert(res.offsets.back() == (int)res.rids.size());
+		for (int i = 0; i < N; i++) {
+			std::vector<int> rids(res.rids.begin() + res.offsets[i], res.rids.begin() + res.offsets[i + 1]);
+			assert(rids == index->select(keys[i]));
+		}
+		index->checkIntegrity();
+	}
+	assert(tree.selectMany({}).offsets.size() == 1);
+	std::filesystem::remove(path);
+}
+
+void filterTest(const int N) {
+	std::cout << "filter test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::STRING };
+	auto path = (std::filesystem::temp_directory_path() / "index_filter_test.pages").string();
+	// each filtered index has a twin without filters that it must agree with
+	Index unique(types, { "NUMBER", "NAME" }, false);
+	Index uniqueTwin(types, { "NUMBER", "NAME" }, false);
+	Index normalized(types, { "NUMBER", "NAME" }, true, true);
+	Index normalizedTwin(types, { "NUMBER", "NAME" }, true, true);
+	Index stored(types, { "NUMBER", "NAME" }, true, false, path, 4);
+	Index storedTwin(types, { "NUMBER", "NAME" }, true);
+	unique.useFilters(true);
+	normalized.useFilters(true);
+	stored.useFilters(true);
+	std::vector<std::pair<Index*, Index*>> pairs = { {&unique, &uniqueTwin}, {&normalized, &normalizedTwin}, {&stored, &storedTwin} };
+
+	// distinct keys, so that a key of the unique index has one rid
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(i), std::string(rand() % 3, 'a' + rand() % 3) });
+	for (int i = 0; i < N * 3; i++) {
+		int index = rand() % N;
+		for (auto [filtered, twin] : pairs) {
+			// uniqueness checks of new keys mostly miss, and those of used keys hit
+			if (!isUsed[index]) {
+				assert(filtered->insert(packed[index], index + 1, true));
+				assert(twin->insert(packed[index], index + 1, true));
+			}
+			else {
+				// a second rid of the key fails in the unique index only
+				bool inserted = filtered->insert(packed[index], N + index + 1, true);
+				assert(inserted == (filtered != &unique));
+				assert(twin->insert(packed[index], N + index + 1, true) == inserted);
+				assert(filtered->remove(packed[index], index + 1, true));
+				assert(twin->remove(packed[index], index + 1, true));
+				if (inserted) {
+					assert(filtered->remove(packed[index], N + index + 1, true));
+					assert(twin->remove(packed[index], N + index + 1, true));
+				}
+			}
+		}
+		isUsed[index] = !isUsed[index];
+		if (i == N)
+			stored.useFilters(false);
+		if (i == N * 2)
+			stored.useFilters(true);
+	}
+
+	for (int i = 0; i < N; i++) {
+		auto key = rand() % 2 == 0 ? packed[i] :
+			PackedData(types, { std::to_string(rand() % (N * 2)), std::string(rand() % 3, 'a' + rand() % 3) });
+		for (auto [filtered, twin] : pairs) {
+			assert(filtered->select(key) == twin->select(key));
+			assert(filtered->select(key, i + 1) == twin->select(key, i + 1));
+		}
+	}
+	for (auto [filtered, twin] : pairs) {
+		filtered->checkIntegrity();
+		assert(filtered->size() == twin->size());
+	}
+	std::filesystem::remove(path);
+}
+
+void upsertTest(const int N) {
+	std::cout << "upsert test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = (std::filesystem::temp_directory_path() / "index_upsert_test.pages").string();
+	Index tree(types, { "NUMBER", "COLOR" }, false);
+	Index normalized(types, { "NUMBER", "COLOR" }, false, true);
+	Index stored(types, { "NUMBER", "COLOR" }, false, false, path, 4);
+	Index filtered(types, { "NUMBER", "COLOR" }, false);
+	filtered.useFilters(true);
+	Index budgeted(types, { "NUMBER", "COLOR" }, false);
+	budgeted.setMaxPushesPerOperation(1);
+	std::vector<Index*> indexes = { &tree, &normalized, &stored, &filtered, &budgeted };
+
+	// few keys, so that most of them are taken and replaced many times; 0 for a free key
+	int numKeys = N / 2 + 1;
+	std::vector<PackedData> packed(numKeys);
+	std::vector<Int64> ridOf(numKeys);
+	for (int i = 0; i < numKeys; i++)
+		packed[i] = PackedData(types, { std::to_string(i * 7), std::to_string(i % 3) });
+	Int64 nextRid = 1;
+	for (int i = 0; i < N * 3; i++) {
+		int index = rand() % numKeys;
+		std::optional<Int64> expected;
+		if (ridOf[index] != 0)
+			expected = ridOf[index];
+		Int64 rid = nextRid++;
+		switch (rand() % 3) {
+		case 0:
+			for (auto target : indexes) {
+				auto res = target->insertUnique(packed[index], rid);
+				assert(res.status == (expected.has_value() ? Index::UniqueResult::Status::CONFLICT :
+					Index::UniqueResult::Status::APPLIED));
+				assert(res.previousRid == expected);
+			}
+			if (!expected.has_value())
+				ridOf[index] = rid;
+			break;
+		case 1:
+			for (auto target : indexes) {
+				auto res = target->upsert(packed[index], rid);
+				assert(res.status == Index::UniqueResult::Status::APPLIED && res.previousRid == expected);
+			}
+			ridOf[index] = rid;
+			break;
+		default:
+			for (auto target : indexes) {
+				// only the rid the key has is removed
+				assert(!target->remove(packed[index], rid, true));
+				if (expected.has_value())
+					assert(target->remove(packed[index], *expected, true));
+			}
+			ridOf[index] = 0;
+		}
+	}
+
+	Int64 numUsed = numKeys - std::count(ridOf.begin(), ridOf.end(), 0);
+	for (auto target : indexes) {
+		target->checkIntegrity();
+		assert(target->size() == numUsed);
+		for (int i = 0; i < numKeys; i++) {
+			auto rids = target->select(packed[i]);
+			assert(rids == (ridOf[i] == 0 ? std::vector<int>{} : std::vector<int>{ (int)ridOf[i] }));
+			assert(ridOf[i] == 0 || target->select(packed[i], ridOf[i]));
+		}
+		auto rids = target->selectRange(packed.front(), packed.back());
+		assert((Int64)rids.size() == numUsed);
+		for (int i = 0, j = 0; i < numKeys; i++)
+			if (ridOf[i] != 0)
+				assert(rids[j++] == ridOf[i]);
+	}
+	std::filesystem::remove(path);
+}
+
 int main() {
 	std::vector<int> ns;
 	for (int i = 1; i < 20; i++)
@@ -298,4 +1416,73 @@ int main() {
 
 	for (auto n : ns)
 		rangeSelectTest(n);
-}
\ No newline at end of file
+
+	for (auto n : ns)
+		batchTest(n);
+
+	for (auto n : ns)
+		rangeBatchTest(n);
+	// a run draining whole internal nodes needs at least three levels at the default BLOCK_SIZE
+	for (auto n : { 10000, 30000 })
+		rangeBatchTest(n);
+
+	for (auto n : ns)
+		checkedBatchTest(n);
+
+	for (auto n : ns)
+		burstTest(n);
+
+	for (auto n : ns)
+		bulkLoadTest(n);
+
+	for (auto n : ns)
+		cursorTest(n);
+
+	for (auto n : ns)
+		normalizedKeyTest(n);
+
+	for (auto n : ns)
+		stringKeyTest(n);
+
+	for (auto n : ns)
+		blockLayoutTest(n);
+
+	for (auto n : ns)
+		prefixTieTest(n);
+
+	for (auto n : ns)
+		storageTest(n);
+
+	for (auto n : ns)
+		storageFailureTest(n);
+
+	for (auto n : ns)
+		checkpointTest(n);
+
+	for (auto n : ns)
+		deferredMaintenanceTest(n);
+
+	for (auto n : ns)
+		boundedMaintenanceTest(n);
+
+	for (auto n : ns)
+		readCompactionTest(n);
+
+	for (auto n : ns)
+		lazySizeTest(n);
+
+	for (auto n : ns)
+		countTest(n);
+
+	for (auto n : ns)
+		sampleTest(n);
+
+	for (auto n : ns)
+		selectManyTest(n);
+
+	for (auto n : ns)
+		filterTest(n);
+
+	for (auto n : ns)
+		upsertTest(n);
+}
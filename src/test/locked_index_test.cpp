@@ -0,0 +1,278 @@
+#include "../locked_index.h"
+
+#include <iostream>
+#include <cassert>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+
+// readers select keys that never change and keys that writers churn, while writers on disjoint keys run at once
+void stressTest(const int N, const std::string& storagePath) {
+	std::cout << "locked index stress test: N = " << N << ", storage = " << !storagePath.empty() << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	LockedIndex tree(types, { "NUMBER", "COLOR" }, true, false, storagePath, 16);
+	const int numWriters = 3;
+	const int numReaders = 4;
+
+	// the first N keys stay; writer t churns keys N * (t + 1) .. N * (t + 2) - 1
+	std::vector<PackedData> packed(N * (numWriters + 1));
+	for (int i = 0; i < (int)packed.size(); i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N * 4)), std::to_string(i % 3) });
+	for (int i = 0; i < N; i++)
+		tree.insert(packed[i], i + 1);
+
+	std::vector<std::vector<int>> isUsed(numWriters, std::vector<int>(N));
+	std::atomic<int> numRunningWriters = numWriters;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numWriters; t++) {
+		threads.emplace_back([&, t]() {
+			auto& used = isUsed[t];
+			std::mt19937 rng(t);
+			for (int i = 0; i < N * 2; i++) {
+				int index = rng() % N;
+				int at = N * (t + 1) + index;
+				if (rng() % 4 == 0) {
+					// one batch with an insertion and a removal
+					int index2 = (index + 1) % N;
+					int at2 = N * (t + 1) + index2;
+					if (index2 == index)
+						continue;
+					std::vector<PackedData> keysToInsert, keysToRemove;
+					std::vector<Int64> ridsToInsert, ridsToRemove;
+					for (auto [j, a] : { std::pair{ index, at }, std::pair{ index2, at2 } }) {
+						(used[j] ? keysToRemove : keysToInsert).push_back(packed[a]);
+						(used[j] ? ridsToRemove : ridsToInsert).push_back(a + 1);
+						used[j] = !used[j];
+					}
+					tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+				}
+				else {
+					if (!used[index])
+						assert(tree.insert(packed[at], at + 1, true));
+					else
+						assert(tree.remove(packed[at], at + 1, true));
+					used[index] = !used[index];
+				}
+			}
+			numRunningWriters--;
+		});
+	}
+	for (int t = 0; t < numReaders; t++) {
+		threads.emplace_back([&, t]() {
+			std::mt19937 rng(numWriters + t);
+			do {
+				int index = rng() % N;
+				assert(tree.select(packed[index], index + 1));
+				auto rids = tree.select(packed[index]);
+				assert(std::find(rids.begin(), rids.end(), index + 1) != rids.end());
+				assert(std::is_sorted(rids.begin(), rids.end()));
+				auto range = tree.selectRange(packed[index], packed[rng() % N]);
+				std::sort(range.begin(), range.end());
+				assert(std::adjacent_find(range.begin(), range.end()) == range.end());
+			} while (numRunningWriters > 0);
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	tree.checkIntegrity();
+	for (int i = 0; i < N; i++)
+		assert(tree.select(packed[i], i + 1));
+	for (int t = 0; t < numWriters; t++)
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[N * (t + 1) + i], N * (t + 1) + i + 1) == (isUsed[t][i] != 0));
+}
+
+// writers committing through a shared log end up in one replayable history
+void loggedStressTest(const int N) {
+	std::cout << "locked index logged stress test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64 };
+	auto path = (std::filesystem::temp_directory_path() / "locked_index_test.log").string();
+	std::filesystem::remove(path);
+	const int numWriters = 4;
+
+	LockedIndex tree(types, { "NUMBER" }, true);
+	std::vector<PackedData> packed(N * numWriters);
+	for (int i = 0; i < (int)packed.size(); i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N + 1)) });
+	{
+		WriteAheadLog log(path);
+		tree.attachLog(&log);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numWriters; t++) {
+			threads.emplace_back([&, t]() {
+				for (int i = N * t; i < N * (t + 1); i++) {
+					tree.insert(packed[i], i + 1);
+					if (i % 3 == 0)
+						tree.remove(packed[i], i + 1);
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		assert(log.durableLsn() == log.lastLsn());
+		tree.attachLog(nullptr);
+	}
+
+	Index replayed(types, { "NUMBER" }, true);
+	replayed.replay(path);
+	replayed.checkIntegrity();
+	for (int i = 0; i < (int)packed.size(); i++) {
+		assert(replayed.select(packed[i], i + 1) == (i % 3 != 0));
+		assert(tree.select(packed[i]) == replayed.select(packed[i]));
+	}
+	std::filesystem::remove(path);
+}
+
+// writers staging their own keys, with readers checking keys flushed before they started
+void writerTest(const int N) {
+	std::cout << "locked index staging writer test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	LockedIndex tree(types, { "NUMBER", "COLOR" }, true);
+	const int numWriters = 4;
+
+	std::vector<PackedData> packed(N * (numWriters + 1));
+	for (int i = 0; i < (int)packed.size(); i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N * 4)), std::to_string(i % 3) });
+	{
+		auto writer = tree.writer(7);
+		for (int i = 0; i < N; i++)
+			writer.insert(packed[i], i + 1);
+	}
+
+	std::vector<std::vector<int>> isUsed(numWriters, std::vector<int>(N));
+	std::atomic<int> numRunningWriters = numWriters;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numWriters; t++) {
+		threads.emplace_back([&, t]() {
+			auto& used = isUsed[t];
+			std::mt19937 rng(t);
+			// a small capacity flushes often, and an insertion and removal of a key may meet in one batch
+			auto writer = tree.writer(1 + t * 5);
+			for (int i = 0; i < N * 2; i++) {
+				int index = rng() % N;
+				int at = N * (t + 1) + index;
+				if (!used[index])
+					writer.insert(packed[at], at + 1);
+				else
+					writer.remove(packed[at], at + 1);
+				used[index] = !used[index];
+				if (rng() % 64 == 0)
+					writer.flush();
+			}
+			writer.flush();
+			assert(writer.numStaged() == 0);
+			numRunningWriters--;
+		});
+	}
+	threads.emplace_back([&]() {
+		std::mt19937 rng(numWriters);
+		do {
+			int index = rng() % N;
+			assert(tree.select(packed[index], index + 1));
+		} while (numRunningWriters > 0);
+	});
+	for (auto& thread : threads)
+		thread.join();
+
+	tree.checkIntegrity();
+	for (int i = 0; i < N; i++)
+		assert(tree.select(packed[i], i + 1));
+	for (int t = 0; t < numWriters; t++)
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[N * (t + 1) + i], N * (t + 1) + i + 1) == (isUsed[t][i] != 0));
+
+	// a writer outliving its index is flushed when the index goes, and drops what it stages later
+	std::optional<LockedIndex::Writer> orphan;
+	{
+		LockedIndex local(types, { "NUMBER", "COLOR" }, true);
+		orphan.emplace(local.writer(N + 1));
+		for (int i = 0; i < N; i++)
+			orphan->insert(packed[i], i + 1);
+		assert(orphan->numStaged() == N);
+	}
+	assert(orphan->numStaged() == 0);
+	orphan->insert(packed[0], 1);
+	assert(!orphan->flush());
+	assert(orphan->numStaged() == 0);
+}
+
+// writers and readers while a maintenance thread pushes down the root buffers and compacts nodes
+void maintenanceTest(const int N) {
+	std::cout << "locked index background maintenance test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	LockedIndex tree(types, { "NUMBER", "COLOR" }, true);
+	tree.startMaintenance(0.5, 4);
+	const int numWriters = 2;
+
+	std::vector<PackedData> packed(N * numWriters);
+	for (int i = 0; i < (int)packed.size(); i++)
+		packed[i] = PackedData(types, { std::to_string(rand() % (N * 4)), std::to_string(i % 3) });
+	std::vector<std::vector<int>> isUsed(numWriters, std::vector<int>(N));
+	std::atomic<int> numRunningWriters = numWriters;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numWriters; t++) {
+		threads.emplace_back([&, t]() {
+			auto& used = isUsed[t];
+			std::mt19937 rng(t);
+			for (int i = 0; i < N * 3; i++) {
+				int index = rng() % N;
+				int at = N * t + index;
+				if (!used[index])
+					tree.insert(packed[at], at + 1);
+				else
+					tree.remove(packed[at], at + 1);
+				used[index] = !used[index];
+				assert(tree.select(packed[at], at + 1) == (used[index] != 0));
+			}
+			numRunningWriters--;
+		});
+	}
+	threads.emplace_back([&]() {
+		std::mt19937 rng(numWriters);
+		do {
+			int index = rng() % (int)packed.size();
+			auto rids = tree.select(packed[index]);
+			assert(std::is_sorted(rids.begin(), rids.end()));
+		} while (numRunningWriters > 0);
+	});
+	for (auto& thread : threads)
+		thread.join();
+	tree.stopMaintenance();
+
+	tree.checkIntegrity();
+	for (int t = 0; t < numWriters; t++)
+		for (int i = 0; i < N; i++)
+			assert(tree.select(packed[N * t + i], N * t + i + 1) == (isUsed[t][i] != 0));
+}
+
+int main() {
+	std::vector<int> ns;
+	for (int i = 1; i < 20; i++)
+		ns.push_back(i);
+	for (int i = 20; i < 100; i += 5)
+		ns.push_back(i);
+	for (int i = 100; i < 1000; i += 100)
+		ns.push_back(i);
+	for (int i = 1000; i <= 3000; i += 1000)
+		ns.push_back(i);
+
+	auto storagePath = (std::filesystem::temp_directory_path() / "locked_index_test.pages").string();
+	for (auto n : ns)
+		stressTest(n, "");
+
+	for (auto n : ns)
+		stressTest(n, storagePath);
+
+	for (auto n : ns)
+		loggedStressTest(n);
+
+	for (auto n : ns)
+		writerTest(n);
+
+	for (auto n : ns)
+		maintenanceTest(n);
+}
@@ -0,0 +1,131 @@
+#include "../typed_index.h"
+
+#include <iostream>
+#include <cassert>
+#include <numeric>
+#include <algorithm>
+#include <random>
+
+void mixedTest(const int N) {
+	std::cout << "typed index mixed insertions and removals test: N = " << N << "\n";
+	using Tree = TypedIndex<Int64, Int32>;
+	Tree tree({ "NUMBER", "COLOR" }, true);
+
+	std::vector<Tree::Key> keys(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		keys[i] = Tree::makeKey(rand() % (N + 1), rand() % 3);
+
+	for (int i = 0; i < N * 3; i++) {
+		int index = rand() % N;
+		if (!isUsed[index])
+			tree.insert(keys[index], index + 1);
+		else
+			tree.remove(keys[index], index + 1);
+		isUsed[index] = !isUsed[index];
+		tree.checkIntegrity();
+	}
+
+	for (int i = 0; i < N; i++)
+		assert(tree.select(keys[i], i + 1) == (isUsed[i] != 0));
+
+	// removing an absent pair fails only when checked, as in Index
+	auto absent = Tree::makeKey(N + 1, 3);
+	assert(tree.remove(absent, 1));
+	assert(!tree.remove(absent, 1, true));
+	tree.checkIntegrity();
+
+	std::vector<int> indirect(N);
+	std::iota(indirect.begin(), indirect.end(), 0);
+	std::sort(indirect.begin(), indirect.end(), [&](int i, int j) {
+		return std::make_pair(keys[i], i) < std::make_pair(keys[j], j);
+	});
+	for (int loop = 0; loop < N; loop++) {
+		auto lo = keys[rand() % N];
+		auto hi = keys[rand() % N];
+		if (hi < lo)
+			std::swap(lo, hi);
+		std::vector<int> expected;
+		for (auto i : indirect)
+			if (isUsed[i] && !(keys[i] < lo) && !(hi < keys[i]))
+				expected.push_back(i + 1);
+		assert(tree.selectRange(lo, hi) == expected);
+	}
+}
+
+void uniqueTest(const int N) {
+	std::cout << "typed index unique key test: N = " << N << "\n";
+	using Tree = TypedIndex<DateTime>;
+	Tree tree({ "TIMESTAMP" }, false);
+
+	std::vector<int> owner(N * 2, 0);
+	for (int i = 0; i < N * 3; i++) {
+		int seconds = rand() % (N * 2);
+		auto key = Tree::makeKey(DateTime(seconds));
+		bool inserted = tree.insert(key, i + 1, true);
+		assert(inserted == (owner[seconds] == 0));
+		if (inserted)
+			owner[seconds] = i + 1;
+		else {
+			assert(tree.remove(key, owner[seconds], true));
+			owner[seconds] = 0;
+		}
+		tree.checkIntegrity();
+	}
+
+	for (int seconds = 0; seconds < N * 2; seconds++) {
+		auto res = tree.select(Tree::makeKey(DateTime(seconds)));
+		if (owner[seconds] == 0)
+			assert(res.empty());
+		else
+			assert(res == std::vector<int>{ owner[seconds] });
+	}
+}
+
+void duplicateUniqueTest(const int N) {
+	std::cout << "typed index unchecked duplicate unique key test: N = " << N << "\n";
+	using Tree = TypedIndex<Int32>;
+	Tree tree({ "NUMBER" }, false);
+
+	// unchecked insertions of a few keys, so that runs of equal keys straddle the splits
+	std::vector<Tree::Key> keys(N);
+	for (int i = 0; i < N; i++) {
+		keys[i] = Tree::makeKey(rand() % 3);
+		tree.insert(keys[i], i + 1);
+	}
+	tree.checkIntegrity();
+
+	std::vector<int> order(N);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), std::mt19937(N));
+	for (int k = 0; k < N; k++) {
+		int i = order[k];
+		assert(tree.select(keys[i], i + 1));
+		assert(tree.remove(keys[i], i + 1, true));
+		assert(!tree.select(keys[i], i + 1));
+		tree.checkIntegrity();
+	}
+	for (int key = 0; key < 3; key++)
+		assert(tree.select(Tree::makeKey(key)).empty());
+}
+
+int main() {
+	std::vector<int> ns;
+	for (int i = 1; i < 20; i++)
+		ns.push_back(i);
+	for (int i = 20; i < 100; i += 5)
+		ns.push_back(i);
+	for (int i = 100; i < 1000; i += 100)
+		ns.push_back(i);
+	for (int i = 1000; i <= 3000; i += 1000)
+		ns.push_back(i);
+
+	for (auto n : ns)
+		mixedTest(n);
+
+	for (auto n : ns)
+		uniqueTest(n);
+
+	for (auto n : ns)
+		duplicateUniqueTest(n);
+}
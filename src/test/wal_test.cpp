@@ -0,0 +1,345 @@
+#include "../index.h"
+
+#include <iostream>
+#include <cassert>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+std::string logPath(const std::string& name)
+{
+	auto path = (std::filesystem::temp_directory_path() / name).string();
+	std::filesystem::remove(path);
+	return path;
+}
+
+void replayTest(const int N) {
+	std::cout << "log replay test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = logPath("wal_replay_test.log");
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	{
+		WriteAheadLog log(path, WriteAheadLog::SyncMode::EACH);
+		tree.attachLog(&log);
+		for (int i = 0; i < N * 2; i++) {
+			if (rand() % 4 == 0) {
+				std::vector<PackedData> keysToInsert, keysToRemove;
+				std::vector<Int64> ridsToInsert, ridsToRemove;
+				for (int j = 0; j < 8; j++) {
+					int index = rand() % N;
+					if (std::find(ridsToInsert.begin(), ridsToInsert.end(), index + 1) != ridsToInsert.end() ||
+						std::find(ridsToRemove.begin(), ridsToRemove.end(), index + 1) != ridsToRemove.end())
+						continue;
+					(isUsed[index] ? keysToRemove : keysToInsert).push_back(packed[index]);
+					(isUsed[index] ? ridsToRemove : ridsToInsert).push_back(index + 1);
+					isUsed[index] = !isUsed[index];
+				}
+				tree.update(keysToInsert, ridsToInsert, keysToRemove, ridsToRemove);
+			}
+			else {
+				int index = rand() % N;
+				if (!isUsed[index])
+					tree.insert(packed[index], index + 1);
+				else
+					tree.remove(packed[index], index + 1);
+				isUsed[index] = !isUsed[index];
+			}
+		}
+		assert(log.durableLsn() == log.lastLsn());
+		tree.attachLog(nullptr);
+	}
+
+	Index replayed(types, { "NUMBER", "COLOR" }, true);
+	auto lsn = replayed.replay(path);
+	assert(lsn > 0);
+	replayed.checkIntegrity();
+	for (int i = 0; i < N; i++) {
+		assert(replayed.select(packed[i], i + 1) == (isUsed[i] != 0));
+		assert(replayed.select(packed[i]) == tree.select(packed[i]));
+	}
+
+	// a reopened log continues after the last lsn
+	WriteAheadLog log(path);
+	assert(log.lastLsn() == lsn);
+	std::filesystem::remove(path);
+}
+
+void tornTailTest(const int N) {
+	std::cout << "torn log tail test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64 };
+	auto path = logPath("wal_torn_test.log");
+
+	std::vector<PackedData> packed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(i) });
+
+	// N single insertions, then a batch of N removals
+	Index tree(types, { "NUMBER" }, true);
+	std::uintmax_t sizeBeforeBatch;
+	{
+		WriteAheadLog log(path);
+		tree.attachLog(&log);
+		for (int i = 0; i < N; i++)
+			tree.insert(packed[i], i + 1);
+		sizeBeforeBatch = std::filesystem::file_size(path);
+
+		std::vector<Int64> rids(N);
+		for (int i = 0; i < N; i++)
+			rids[i] = i + 1;
+		tree.remove(packed, rids);
+		tree.attachLog(nullptr);
+	}
+	auto fullSize = std::filesystem::file_size(path);
+
+	// cutting anywhere into the batch loses the whole batch
+	auto cut = sizeBeforeBatch + rand() % (fullSize - sizeBeforeBatch);
+	std::filesystem::resize_file(path, cut);
+	{
+		Index replayed(types, { "NUMBER" }, true);
+		assert(replayed.replay(path) == N);
+		for (int i = 0; i < N; i++)
+			assert(replayed.select(packed[i], i + 1));
+	}
+
+	// a flipped byte in a record stops replay at the batch before it
+	int victim = rand() % N;
+	{
+		WriteAheadLog log(path);
+		assert(log.lastLsn() == N);
+		assert(std::filesystem::file_size(path) == sizeBeforeBatch);
+	}
+	{
+		std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+		auto recordSize = sizeBeforeBatch / N;
+		file.seekp(victim * recordSize + recordSize - 1);
+		char c = 0;
+		file.read(&c, 1);
+		c ^= 0x40;
+		file.seekp(victim * recordSize + recordSize - 1);
+		file.write(&c, 1);
+	}
+	{
+		Index replayed(types, { "NUMBER" }, true);
+		assert(replayed.replay(path) == victim);
+		for (int i = 0; i < N; i++)
+			assert(replayed.select(packed[i], i + 1) == (i < victim));
+	}
+	std::filesystem::remove(path);
+}
+
+void checkpointReplayTest(const int N) {
+	std::cout << "checkpoint then log replay test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = logPath("wal_checkpoint_test.log");
+	auto checkpointPath = logPath("wal_checkpoint_test.ckpt");
+
+	std::vector<PackedData> packed(N);
+	std::vector<int> isUsed(N);
+	for (int i = 0; i < N; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	// changes before and after the checkpoint all go to the log
+	Index tree(types, { "NUMBER", "COLOR" }, true);
+	{
+		WriteAheadLog log(path);
+		tree.attachLog(&log);
+		for (int loop = 0; loop < 2; loop++) {
+			for (int i = 0; i < N; i++) {
+				int index = rand() % N;
+				if (!isUsed[index])
+					tree.insert(packed[index], index + 1);
+				else
+					tree.remove(packed[index], index + 1);
+				isUsed[index] = !isUsed[index];
+			}
+			if (loop == 0)
+				assert(tree.checkpoint(checkpointPath));
+		}
+		tree.attachLog(nullptr);
+	}
+
+	// replaying the whole log over the checkpoint applies only the changes after it
+	auto opened = Index::open(checkpointPath);
+	assert(opened.has_value());
+	opened->replay(path);
+	opened->checkIntegrity();
+	for (int i = 0; i < N; i++)
+		assert(opened->select(packed[i], i + 1) == (isUsed[i] != 0));
+	std::filesystem::remove(path);
+	std::filesystem::remove(checkpointPath);
+}
+
+void groupCommitTest(const int N) {
+	std::cout << "group commit test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64 };
+	auto path = logPath("wal_group_test.log");
+	const int numThreads = 4;
+
+	{
+		WriteAheadLog log(path, WriteAheadLog::SyncMode::GROUP);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&log, &types, t, N]() {
+				for (int i = 0; i < N; i++) {
+					PackedData key(types, { std::to_string(t * N + i) });
+					auto lsn = log.append(WriteAheadLog::RecordType::INSERT, key, t * N + i + 1);
+					log.commit(lsn);
+					assert(log.durableLsn() >= lsn);
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		assert(log.durableLsn() == (Int64)numThreads * N);
+		assert(log.numSyncs() <= (long long)numThreads * N);
+	}
+
+	std::vector<int> seen(numThreads * N);
+	WriteAheadLog::Lsn prev = 0;
+	auto last = WriteAheadLog::replay(path, [&](const WriteAheadLog::Record& record) {
+		assert(record.lsn == prev + 1);
+		prev = record.lsn;
+		assert(record.type == WriteAheadLog::RecordType::INSERT && record.endsBatch);
+		seen[record.rid - 1]++;
+	});
+	assert(last == (Int64)numThreads * N);
+	assert(std::all_of(seen.begin(), seen.end(), [](int count) { return count == 1; }));
+	std::filesystem::remove(path);
+}
+
+// upsert() logs the removal of the replaced rid and the insertion of the new one as one batch
+void upsertReplayTest(const int N) {
+	std::cout << "upsert replay test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64, DataType::INT32 };
+	auto path = logPath("wal_upsert_replay_test.log");
+
+	int numKeys = N / 2 + 1;
+	std::vector<PackedData> packed(numKeys);
+	for (int i = 0; i < numKeys; i++)
+		packed[i] = PackedData(types, { std::to_string(rand()), std::to_string(rand() % 3) });
+
+	Index tree(types, { "NUMBER", "COLOR" }, false);
+	{
+		WriteAheadLog log(path, WriteAheadLog::SyncMode::EACH);
+		tree.attachLog(&log);
+		for (int i = 0; i < N * 2; i++) {
+			int index = rand() % numKeys;
+			if (rand() % 4 == 0) {
+				auto rids = tree.select(packed[index]);
+				if (!rids.empty())
+					tree.remove(packed[index], rids.front());
+			}
+			else if (rand() % 2 == 0)
+				tree.upsert(packed[index], i + 1);
+			else
+				tree.insertUnique(packed[index], i + 1);
+		}
+		assert(log.durableLsn() == log.lastLsn());
+		tree.attachLog(nullptr);
+	}
+
+	Index replayed(types, { "NUMBER", "COLOR" }, false);
+	replayed.replay(path);
+	replayed.checkIntegrity();
+	assert(replayed.size() == tree.size());
+	for (int i = 0; i < numKeys; i++)
+		assert(replayed.select(packed[i]) == tree.select(packed[i]));
+	std::filesystem::remove(path);
+}
+
+// a log that cannot be written fails for good, and every change through it fails too
+void failedLogTest(const int N) {
+	std::cout << "failed log test: N = " << N << "\n";
+	std::vector<DataType> types = { DataType::INT64 };
+
+	// a log in a directory that does not exist cannot even be opened
+	{
+		auto missing = (std::filesystem::temp_directory_path() / "wal_missing_directory" / "test.log").string();
+		WriteAheadLog log(missing, WriteAheadLog::SyncMode::EACH);
+		assert(log.hasFailed());
+		Index tree(types, { "NUMBER" }, false);
+		tree.attachLog(&log);
+		assert(!tree.insert(PackedData(types, { "0" }), 1));
+		assert(tree.size() == 0);
+		tree.attachLog(nullptr);
+	}
+
+	// every write to /dev/full fails for lack of space; elsewhere there is nothing more to test with
+	const std::string path = "/dev/full";
+	if (!std::filesystem::exists(path))
+		return;
+	for (auto mode : { WriteAheadLog::SyncMode::EACH, WriteAheadLog::SyncMode::GROUP }) {
+		WriteAheadLog log(path, mode);
+		Index tree(types, { "NUMBER" }, false);
+		tree.attachLog(&log);
+		for (int i = 0; i < N; i++) {
+			PackedData key(types, { std::to_string(i) });
+			assert(!tree.insert(key, i + 1));
+			assert(log.hasFailed() && log.durableLsn() == 0);
+		}
+		// the first insertion failed only on commit; the rest were refused
+		assert(tree.size() == 1);
+		assert(log.lastLsn() == 1);
+
+		PackedData key(types, { std::to_string(N) });
+		auto refused = tree.upsert(key, N + 1);
+		assert(refused.status == Index::UniqueResult::Status::FAILED && !refused.previousRid.has_value());
+		assert(tree.insertUnique(key, N + 1).status == Index::UniqueResult::Status::FAILED);
+		assert(!tree.update({ key }, { N + 1 }, {}, {}));
+		assert(!tree.remove(PackedData(types, { "0" }), 1));
+		assert(tree.size() == 1);
+		tree.attachLog(nullptr);
+	}
+
+	// an upsert failing only on commit stays applied in memory: the rid is replaced, and nothing is rolled back
+	for (auto mode : { WriteAheadLog::SyncMode::EACH, WriteAheadLog::SyncMode::GROUP }) {
+		WriteAheadLog log(path, mode);
+		Index tree(types, { "NUMBER" }, false);
+		PackedData key(types, { std::to_string(N) });
+		assert(tree.insert(key, 1));
+		tree.attachLog(&log);
+		auto res = tree.upsert(key, 2);
+		assert(res.status == Index::UniqueResult::Status::FAILED && res.previousRid == 1);
+		assert(tree.select(key) == std::vector<int>{ 2 });
+		assert(tree.size() == 1);
+		tree.checkIntegrity();
+		tree.attachLog(nullptr);
+	}
+}
+
+int main() {
+	std::vector<int> ns;
+	for (int i = 1; i < 20; i++)
+		ns.push_back(i);
+	for (int i = 20; i < 100; i += 5)
+		ns.push_back(i);
+	for (int i = 100; i < 1000; i += 100)
+		ns.push_back(i);
+	for (int i = 1000; i <= 3000; i += 1000)
+		ns.push_back(i);
+
+	for (auto n : ns)
+		replayTest(n);
+
+	for (auto n : ns)
+		tornTailTest(n);
+
+	for (auto n : ns)
+		checkpointReplayTest(n);
+
+	for (auto n : ns)
+		groupCommitTest(n);
+
+	for (auto n : ns)
+		upsertReplayTest(n);
+
+	for (auto n : ns)
+		failedLogTest(n);
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "constants.h"
+#include "data.h"
+
+#include <array>
+#include <tuple>
+#include <vector>
+#include <cassert>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+// the value stored inline for each column type of TypedIndex
+template<typename T>
+struct KeyColumn {
+	using Value = T;
+	static Value get(const T& val) { return val; }
+};
+
+template<>
+struct KeyColumn<Date> {
+	using Value = Int32;
+	static Value get(const Date& val) { return val.data(); }
+};
+
+template<>
+struct KeyColumn<DateTime> {
+	using Value = Int64;
+	static Value get(const DateTime& val) { return val.data(); }
+};
+
+template<>
+struct KeyColumn<HashedInt> {
+	using Value = Int64;
+	static Value get(const HashedInt& val) { return val.data(); }
+};
+
+// B+ tree for a schema fixed at compile time, e.g., TypedIndex<Int64, Int32> or TypedIndex<DateTime>
+// -- keys are stored inline as tuples, and nodes are sized to BLOCK_SIZE at compile time
+// -- insert/remove/select/selectRange behave as in Index
+template<typename... KeyTypes>
+class TypedIndex {
+public:
+	using Key = std::tuple<typename KeyColumn<KeyTypes>::Value...>;
+
+	static Key makeKey(const KeyTypes&... vals) {
+		return Key(KeyColumn<KeyTypes>::get(vals)...);
+	}
+
+private:
+	struct Entry {
+		Key key;
+		Int64 rid;
+	};
+
+	// a node holds at most MAX_KEYS entries (and MAX_KEYS + 1 children) within BLOCK_SIZE
+	// -- one more slot is reserved so that a node can overflow before it is split
+	static constexpr int computeBranchingFactor() {
+		int header = (int)(sizeof(int) * 2 + sizeof(void*));
+		int perKey = (int)(sizeof(Entry) + sizeof(void*));
+		return (BLOCK_SIZE - header - perKey) / perKey;
+	}
+	static constexpr int MAX_KEYS = computeBranchingFactor() < 3 ? 3 : computeBranchingFactor();
+	static constexpr int MIN_KEYS = MAX_KEYS / 2;
+
+	struct Node {
+		int size{ 0 };
+		bool isLeaf;
+		Node* next{ nullptr };
+		std::array<Entry, MAX_KEYS + 1> entries;
+		std::array<Node*, MAX_KEYS + 2> children;
+		Node(bool isLeaf) : isLeaf(isLeaf) {}
+	};
+
+	struct Split {
+		Entry separator;
+		Node* right;
+	};
+
+public:
+	TypedIndex(const std::vector<std::string>& names, bool allowsDuplicate) :
+		names(names), allowsDuplicate(allowsDuplicate), root(new Node(true)) {
+		assert(names.size() == sizeof...(KeyTypes));
+	}
+	TypedIndex(TypedIndex&& other) noexcept :
+		names(std::move(other.names)), allowsDuplicate(other.allowsDuplicate), root(other.root) {
+		other.root = nullptr;
+	}
+	TypedIndex(const TypedIndex&) = delete;
+	~TypedIndex() { clean(root); }
+
+	// returns true if success
+	bool insert(const Key& key, Int64 rid, bool checksIntegrity = false) {
+		if (checksIntegrity && !allowsDuplicate && !select(key).empty())
+			return false;
+		auto split = insert(root, Entry{ key, rid });
+		if (split.right != nullptr) {
+			auto node = new Node(false);
+			node->entries[0] = split.separator;
+			node->children[0] = root;
+			node->children[1] = split.right;
+			node->size = 1;
+			root = node;
+		}
+		return true;
+	}
+
+	// returns true if success
+	bool remove(const Key& key, Int64 rid, bool checksIntegrity = false) {
+		if (checksIntegrity && !select(key, rid))
+			return false;
+		// as in Index, an unchecked removal of an absent pair still succeeds
+		remove(root, Entry{ key, rid });
+		if (!root->isLeaf && root->size == 0) {
+			auto node = root->children[0];
+			delete root;
+			root = node;
+		}
+		return true;
+	}
+
+	// returns rids: equal search
+	std::vector<int> select(const Key& key) {
+		return select(Entry{ key, MIN_RID }, Entry{ key, MAX_RID });
+	}
+
+	// returns rids: range search
+	std::vector<int> selectRange(const Key& loKey, const Key& hiKey) {
+		return select(Entry{ loKey, MIN_RID }, Entry{ hiKey, MAX_RID });
+	}
+
+	// returns true if exists
+	bool select(const Key& key, Int64 rid) {
+		auto res = select(Entry{ key, rid }, Entry{ key, rid });
+		for (auto r : res)
+			if (r == rid)
+				return true;
+		return false;
+	}
+
+	void dump(std::ostream& os = std::cout) {
+		os << "==========dump start==========\n";
+		dump(root, os);
+		os << "==========dump end==========\n\n";
+	}
+
+	void checkIntegrity() {
+		int depth = -1;
+		checkIntegrity(root, nullptr, nullptr, 0, depth);
+	}
+
+private:
+	const std::vector<std::string> names;
+	const bool allowsDuplicate;
+	Node* root;
+
+	static constexpr bool compareEntry(const Entry& e1, const Entry& e2, bool comparesRid) {
+		if (e1.key != e2.key)
+			return e1.key < e2.key;
+		return comparesRid && e1.rid < e2.rid;
+	}
+
+	bool less(const Entry& e1, const Entry& e2) const {
+		return compareEntry(e1, e2, allowsDuplicate);
+	}
+
+	// number of separators <= entry, i.e., the child covering entry
+	int findChild(Node* curr, const Entry& entry) const {
+		auto it = std::upper_bound(curr->entries.begin(), curr->entries.begin() + curr->size, entry,
+			[this](const Entry& e1, const Entry& e2) {return less(e1, e2); });
+		return (int)(it - curr->entries.begin());
+	}
+
+	// number of entries < entry
+	int lowerBound(Node* curr, const Entry& entry) const {
+		auto it = std::lower_bound(curr->entries.begin(), curr->entries.begin() + curr->size, entry,
+			[this](const Entry& e1, const Entry& e2) {return less(e1, e2); });
+		return (int)(it - curr->entries.begin());
+	}
+
+	Split insert(Node* curr, const Entry& entry) {
+		if (curr->isLeaf) {
+			int pos = findChild(curr, entry);
+			std::move_backward(curr->entries.begin() + pos, curr->entries.begin() + curr->size,
+				curr->entries.begin() + curr->size + 1);
+			curr->entries[pos] = entry;
+			curr->size++;
+		}
+		else {
+			int pos = findChild(curr, entry);
+			auto split = insert(curr->children[pos], entry);
+			if (split.right == nullptr)
+				return {};
+			std::move_backward(curr->entries.begin() + pos, curr->entries.begin() + curr->size,
+				curr->entries.begin() + curr->size + 1);
+			std::move_backward(curr->children.begin() + pos + 1, curr->children.begin() + curr->size + 1,
+				curr->children.begin() + curr->size + 2);
+			curr->entries[pos] = split.separator;
+			curr->children[pos + 1] = split.right;
+			curr->size++;
+		}
+		if (curr->size <= MAX_KEYS)
+			return {};
+
+		// split in half; a leaf copies up its middle entry, and an internal node moves it up
+		auto right = new Node(curr->isLeaf);
+		int k = curr->size / 2;
+		Split res{ curr->entries[k], right };
+		if (curr->isLeaf) {
+			right->size = curr->size - k;
+			std::copy(curr->entries.begin() + k, curr->entries.begin() + curr->size, right->entries.begin());
+			right->next = curr->next;
+			curr->next = right;
+		}
+		else {
+			right->size = curr->size - k - 1;
+			std::copy(curr->entries.begin() + k + 1, curr->entries.begin() + curr->size, right->entries.begin());
+			std::copy(curr->children.begin() + k + 1, curr->children.begin() + curr->size + 1, right->children.begin());
+		}
+		curr->size = k;
+		return res;
+	}
+
+	// returns true if removed
+	// -- as in select(), entries equal to a separator may sit on both sides of it in a unique index holding
+	// duplicate keys, so every child from the leftmost one that may hold entry is tried
+	bool remove(Node* curr, const Entry& entry) {
+		if (curr->isLeaf) {
+			for (int pos = lowerBound(curr, entry); pos < curr->size && !less(entry, curr->entries[pos]); pos++) {
+				if (curr->entries[pos].rid != entry.rid)
+					continue;
+				std::move(curr->entries.begin() + pos + 1, curr->entries.begin() + curr->size, curr->entries.begin() + pos);
+				curr->size--;
+				return true;
+			}
+			return false;
+		}
+		int last = findChild(curr, entry);
+		for (int pos = lowerBound(curr, entry); pos <= last; pos++) {
+			if (!remove(curr->children[pos], entry))
+				continue;
+			if (curr->children[pos]->size < MIN_KEYS)
+				rebalance(curr, pos);
+			return true;
+		}
+		return false;
+	}
+
+	// refill the pos-th child of curr by borrowing from or merging with a sibling
+	void rebalance(Node* curr, int pos) {
+		if (pos > 0 && curr->children[pos - 1]->size > MIN_KEYS) {
+			borrowFromLeft(curr, pos);
+			return;
+		}
+		if (pos < curr->size && curr->children[pos + 1]->size > MIN_KEYS) {
+			borrowFromRight(curr, pos);
+			return;
+		}
+		merge(curr, pos > 0 ? pos - 1 : pos);
+	}
+
+	void borrowFromLeft(Node* curr, int pos) {
+		auto left = curr->children[pos - 1];
+		auto child = curr->children[pos];
+		std::move_backward(child->entries.begin(), child->entries.begin() + child->size,
+			child->entries.begin() + child->size + 1);
+		if (child->isLeaf) {
+			child->entries[0] = left->entries[left->size - 1];
+			curr->entries[pos - 1] = child->entries[0];
+		}
+		else {
+			std::move_backward(child->children.begin(), child->children.begin() + child->size + 1,
+				child->children.begin() + child->size + 2);
+			child->entries[0] = curr->entries[pos - 1];
+			child->children[0] = left->children[left->size];
+			curr->entries[pos - 1] = left->entries[left->size - 1];
+		}
+		child->size++;
+		left->size--;
+	}
+
+	void borrowFromRight(Node* curr, int pos) {
+		auto child = curr->children[pos];
+		auto right = curr->children[pos + 1];
+		if (child->isLeaf) {
+			child->entries[child->size] = right->entries[0];
+			std::move(right->entries.begin() + 1, right->entries.begin() + right->size, right->entries.begin());
+			curr->entries[pos] = right->entries[0];
+		}
+		else {
+			child->entries[child->size] = curr->entries[pos];
+			child->children[child->size + 1] = right->children[0];
+			curr->entries[pos] = right->entries[0];
+			std::move(right->entries.begin() + 1, right->entries.begin() + right->size, right->entries.begin());
+			std::move(right->children.begin() + 1, right->children.begin() + right->size + 1, right->children.begin());
+		}
+		child->size++;
+		right->size--;
+	}
+
+	// merge the (pos + 1)-th child of curr into the pos-th child
+	void merge(Node* curr, int pos) {
+		auto left = curr->children[pos];
+		auto right = curr->children[pos + 1];
+		if (left->isLeaf) {
+			std::copy(right->entries.begin(), right->entries.begin() + right->size, left->entries.begin() + left->size);
+			left->size += right->size;
+			left->next = right->next;
+		}
+		else {
+			left->entries[left->size] = curr->entries[pos];
+			std::copy(right->entries.begin(), right->entries.begin() + right->size, left->entries.begin() + left->size + 1);
+			std::copy(right->children.begin(), right->children.begin() + right->size + 1, left->children.begin() + left->size + 1);
+			left->size += right->size + 1;
+		}
+		delete right;
+		std::move(curr->entries.begin() + pos + 1, curr->entries.begin() + curr->size, curr->entries.begin() + pos);
+		std::move(curr->children.begin() + pos + 2, curr->children.begin() + curr->size + 1, curr->children.begin() + pos + 1);
+		curr->size--;
+	}
+
+	std::vector<int> select(const Entry& lo, const Entry& hi) {
+		// descend to the leftmost leaf that may hold lo; entries equal to a separator may sit on both sides of it
+		// in a unique index holding duplicate keys
+		auto curr = root;
+		while (!curr->isLeaf)
+			curr = curr->children[lowerBound(curr, lo)];
+		std::vector<int> res;
+		for (int pos = lowerBound(curr, lo); curr != nullptr; curr = curr->next, pos = 0) {
+			for (; pos < curr->size; pos++) {
+				if (less(hi, curr->entries[pos]))
+					return res;
+				res.push_back((int)curr->entries[pos].rid);
+			}
+		}
+		return res;
+	}
+
+	void clean(Node* curr) {
+		if (curr == nullptr)
+			return;
+		if (!curr->isLeaf) {
+			for (int i = 0; i <= curr->size; i++)
+				clean(curr->children[i]);
+		}
+		delete curr;
+	}
+
+	void dump(Node* curr, std::ostream& os) {
+		os << curr << "\n";
+		os << "size = " << curr->size << "\n";
+		os << "entries = [";
+		for (int i = 0; i < curr->size; i++) {
+			os << "((";
+			std::apply([&os](const auto&... vals) {((os << vals << " "), ...); }, curr->entries[i].key);
+			os << ")," << curr->entries[i].rid << "),";
+		}
+		os << "]\n";
+		if (!curr->isLeaf) {
+			for (int i = 0; i <= curr->size; i++)
+				dump(curr->children[i], os);
+		}
+	}
+
+	void checkIntegrity(Node* curr, const Entry* lb, const Entry* ub, int depth, int& leafDepth) {
+		assert(curr == root || curr->size >= MIN_KEYS);
+		assert(curr->size <= MAX_KEYS);
+		for (int i = 0; i < curr->size; i++) {
+			assert(i == 0 || !less(curr->entries[i], curr->entries[i - 1]));
+			assert(lb == nullptr || !less(curr->entries[i], *lb));
+			assert(ub == nullptr || (allowsDuplicate ? less(curr->entries[i], *ub) : !less(*ub, curr->entries[i])));
+		}
+		if (curr->isLeaf) {
+			if (leafDepth < 0)
+				leafDepth = depth;
+			assert(leafDepth == depth);
+			return;
+		}
+		for (int i = 0; i <= curr->size; i++) {
+			checkIntegrity(curr->children[i],
+				i == 0 ? lb : &curr->entries[i - 1],
+				i == curr->size ? ub : &curr->entries[i],
+				depth + 1, leafDepth);
+		}
+	}
+};
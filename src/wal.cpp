@@ -0,0 +1,232 @@
+#include "wal.h"
+#include "file_sync.h"
+
+#include <array>
+#include <thread>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+	// size and crc32 in front of each record
+	constexpr size_t HEADER_SIZE = sizeof(std::uint32_t) * 2;
+	// lsn, type, endsBatch and rid in front of the key bytes
+	constexpr size_t FIXED_BODY_SIZE = sizeof(Int64) + sizeof(std::uint8_t) * 2 + sizeof(Int64);
+	// anything larger is taken as garbage rather than a record
+	constexpr std::uint32_t MAX_BODY_SIZE = 1 << 24;
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, SyncMode mode, std::chrono::microseconds commitDelay) :
+	path(path), mode(mode), commitDelay(commitDelay), file(nullptr),
+	nextLsn(1), _durableLsn(0), isFlushing(false), _numSyncs(0), _hasFailed(false)
+{
+	std::uintmax_t validSize = 0;
+	_durableLsn = scan(path, [](const Record&) {}, validSize);
+	nextLsn = _durableLsn + 1;
+	if (std::filesystem::is_regular_file(path) && std::filesystem::file_size(path) != validSize)
+		std::filesystem::resize_file(path, validSize);
+	file = std::fopen(path.c_str(), "ab");
+	// a log that cannot be opened is failed from the start: every commit() returns false
+	_hasFailed = file == nullptr;
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+	// nothing to report a failure to here; a caller that cares has committed already
+	commit(lastLsn());
+	if (file != nullptr)
+		std::fclose(file);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::append(RecordType type, const PackedData& key, Int64 rid, bool endsBatch)
+{
+	std::uint32_t bodySize = (std::uint32_t)(FIXED_BODY_SIZE + key.size());
+	std::lock_guard<std::mutex> lock(mutex);
+	Lsn lsn = nextLsn++;
+
+	size_t start = pending.size();
+	pending.resize(start + HEADER_SIZE + bodySize);
+	std::byte* header = pending.data() + start;
+	std::byte* ptr = header + HEADER_SIZE;
+	auto write = [&ptr](const void* data, size_t size) {
+		std::memcpy(ptr, data, size);
+		ptr += size;
+	};
+	std::uint8_t ends = endsBatch ? 1 : 0;
+	write(&lsn, sizeof(lsn));
+	write(&type, sizeof(type));
+	write(&ends, sizeof(ends));
+	write(&rid, sizeof(rid));
+	write(key.get(), key.size());
+
+	std::uint32_t crc = crc32(header + HEADER_SIZE, bodySize);
+	std::memcpy(header, &bodySize, sizeof(bodySize));
+	std::memcpy(header + sizeof(bodySize), &crc, sizeof(crc));
+	return lsn;
+}
+
+bool WriteAheadLog::commit(Lsn lsn)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (mode == SyncMode::EACH) {
+		if (_hasFailed)
+			return _durableLsn >= lsn;
+		// no sharing: the fsync is paid by every commit
+		if (!write(pending)) {
+			_hasFailed = true;
+			return _durableLsn >= lsn;
+		}
+		pending.clear();
+		_durableLsn = nextLsn - 1;
+		_numSyncs++;
+		return true;
+	}
+
+	while (_durableLsn < lsn) {
+		if (_hasFailed)
+			return false;
+		if (isFlushing) {
+			// a leader is writing; its batch may or may not cover lsn
+			flushed.wait(lock);
+			continue;
+		}
+		// become the leader and write everything appended so far, including the records of the followers
+		isFlushing = true;
+		if (commitDelay.count() > 0) {
+			lock.unlock();
+			std::this_thread::sleep_for(commitDelay);
+			lock.lock();
+		}
+		writing.swap(pending);
+		Lsn last = nextLsn - 1;
+		lock.unlock();
+		bool isWritten = write(writing);
+		writing.clear();
+		lock.lock();
+		// the followers wake up either way, to find their records durable or the log failed
+		if (isWritten) {
+			_durableLsn = last;
+			_numSyncs++;
+		}
+		else
+			_hasFailed = true;
+		isFlushing = false;
+		flushed.notify_all();
+	}
+	return true;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::replay(const std::string& path, const std::function<void(const Record&)>& apply)
+{
+	std::uintmax_t validSize;
+	return scan(path, apply, validSize);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::lastLsn()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return nextLsn - 1;
+}
+
+WriteAheadLog::Lsn WriteAheadLog::durableLsn()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return _durableLsn;
+}
+
+long long WriteAheadLog::numSyncs()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return _numSyncs;
+}
+
+bool WriteAheadLog::hasFailed()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return _hasFailed;
+}
+
+bool WriteAheadLog::write(const std::vector<std::byte>& buffer)
+{
+	if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+		return false;
+	return syncFile(file);
+}
+
+WriteAheadLog::Lsn WriteAheadLog::scan(const std::string& path, const std::function<void(const Record&)>& apply,
+	std::uintmax_t& validSize)
+{
+	validSize = 0;
+	auto in = std::fopen(path.c_str(), "rb");
+	if (in == nullptr)
+		return 0;
+
+	Lsn last = 0;
+	std::uintmax_t size = 0;
+	std::vector<std::byte> body;
+	// records of the batch being read, applied once its last record is read
+	std::vector<Record> batch;
+	while (true) {
+		std::uint32_t header[2];
+		if (std::fread(header, 1, HEADER_SIZE, in) != HEADER_SIZE)
+			break;
+		std::uint32_t bodySize = header[0];
+		if (bodySize < FIXED_BODY_SIZE || bodySize > MAX_BODY_SIZE)
+			break;
+		body.resize(bodySize);
+		if (std::fread(body.data(), 1, bodySize, in) != bodySize)
+			break;
+		if (crc32(body.data(), bodySize) != header[1])
+			break;
+
+		Record record;
+		const std::byte* ptr = body.data();
+		auto read = [&ptr](void* data, size_t size) {
+			std::memcpy(data, ptr, size);
+			ptr += size;
+		};
+		std::uint8_t ends;
+		read(&record.lsn, sizeof(record.lsn));
+		read(&record.type, sizeof(record.type));
+		read(&ends, sizeof(ends));
+		read(&record.rid, sizeof(record.rid));
+		record.endsBatch = ends != 0;
+		int keySize = (int)(bodySize - FIXED_BODY_SIZE);
+		record.key = PackedData(keySize);
+		record.key.push(ptr, keySize);
+		// lsns only grow; anything else is a leftover of an older log
+		Lsn prev = batch.empty() ? last : batch.back().lsn;
+		if (record.lsn <= prev)
+			break;
+
+		size += HEADER_SIZE + bodySize;
+		batch.push_back(std::move(record));
+		if (batch.back().endsBatch) {
+			for (auto& r : batch)
+				apply(r);
+			last = batch.back().lsn;
+			validSize = size;
+			batch.clear();
+		}
+	}
+	std::fclose(in);
+	return last;
+}
+
+std::uint32_t WriteAheadLog::crc32(const std::byte* data, size_t size)
+{
+	// CRC-32 (IEEE 802.3), reflected, one byte at a time
+	static const auto table = [] {
+		std::array<std::uint32_t, 256> table{};
+		for (std::uint32_t i = 0; i < 256; i++) {
+			std::uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		return table;
+	}();
+	std::uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ static_cast<std::uint32_t>(data[i])) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
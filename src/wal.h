@@ -0,0 +1,92 @@
+#pragma once
+
+#include "data.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+// append-only log of logical insertions and removals
+// -- a record is [size, crc32, lsn, type, endsBatch, rid, key bytes], where size and crc32 cover the part after them
+// -- records up to one with endsBatch form a batch, which is replayed entirely or not at all
+// -- append() only buffers a record; commit(lsn) returns once every record up to lsn is on disk
+// -- a failed write or fsync leaves the log failed for good: what it had not committed never is, and every
+// later commit() returns false
+class WriteAheadLog {
+public:
+	using Lsn = Int64;
+
+	enum class RecordType : std::uint8_t {
+		INSERT = 1,
+		REMOVE = 2,
+	};
+
+	enum class SyncMode {
+		// every commit() writes and fsyncs by itself
+		EACH,
+		// one committer writes and fsyncs the records of everyone waiting, and the others wait for it
+		GROUP,
+	};
+
+	struct Record {
+		Lsn lsn;
+		RecordType type;
+		bool endsBatch;
+		Int64 rid;
+		PackedData key;
+	};
+
+	// opens or creates the log at path; a torn or corrupted tail and an unfinished batch are cut off
+	// -- a log that cannot be opened has failed from the start (see hasFailed())
+	// commitDelay: with GROUP, how long a committer waits for others to join before it writes
+	WriteAheadLog(const std::string& path, SyncMode mode = SyncMode::GROUP,
+		std::chrono::microseconds commitDelay = std::chrono::microseconds(0));
+	WriteAheadLog(const WriteAheadLog&) = delete;
+	// commits whatever is appended
+	~WriteAheadLog();
+
+	// thread-safe
+	// endsBatch: false if the next record of this thread belongs to the same batch
+	// -- appends of other threads must not come in between
+	Lsn append(RecordType type, const PackedData& key, Int64 rid, bool endsBatch = true);
+	// returns false if a record up to lsn is not on disk, as the log has failed
+	bool commit(Lsn lsn);
+	// calls apply for every record of complete batches in order, stopping at the first torn or corrupted record
+	// returns the last lsn applied, or 0 if there is none
+	static Lsn replay(const std::string& path, const std::function<void(const Record&)>& apply);
+
+	Lsn lastLsn();
+	Lsn durableLsn();
+	long long numSyncs();
+	bool hasFailed();
+private:
+	std::string path;
+	const SyncMode mode;
+	const std::chrono::microseconds commitDelay;
+	std::FILE* file;
+
+	std::mutex mutex;
+	std::condition_variable flushed;
+	// records appended but not written yet
+	std::vector<std::byte> pending;
+	// records being written by the leader; swapped with pending so that neither is reallocated
+	std::vector<std::byte> writing;
+	Lsn nextLsn;
+	Lsn _durableLsn;
+	bool isFlushing;
+	long long _numSyncs;
+	// set once a write or fsync fails; the file may end in part of a record, which only a reopen cuts off
+	bool _hasFailed;
+
+	// write buffer and fsync; called without holding mutex except with EACH
+	// returns false if either fails
+	bool write(const std::vector<std::byte>& buffer);
+	// replay() that also reports the size of the valid prefix of the file
+	static Lsn scan(const std::string& path, const std::function<void(const Record&)>& apply, std::uintmax_t& validSize);
+	static std::uint32_t crc32(const std::byte* data, size_t size);
+};